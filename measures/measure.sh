@@ -55,5 +55,27 @@ function measure_units() {
 
 }
 
+function measure_long_runs() {
+    binary_name="${1}"
+    sizes="1000 5000"
+    years="1000000 2000000"
+
+    for sz in ${sizes}; do
+        for y in ${years}; do
+            output="_${sz}_${y}"
+            logs="logs/logs_${sz}_${y}_long"
+            echo "current setup: output=${output}, size=${sz}, years=${y}"
+
+            taskset -c 5 ./${binary_name}  \
+                --sizex="${sz}" \
+                --sizey="${sz}" \
+                --years="${y}" \
+                --output="${output}" > "${logs}"
+        done
+    done
+
+}
+
 # measure_whole "whole_measure"
 measure_units "units_measure"
+# measure_long_runs "units_measure"
@@ -0,0 +1,530 @@
+#include <array>
+#include <cstdlib>
+#include <atomic>
+#include <barrier>
+#include <algorithm>
+#include <bit>
+#include "boundary_graph.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace generation;
+using namespace utils;
+
+namespace {
+    // Direction switch parameters from Beamer et al.,
+    // "Direction-Optimizing Breadth-First Search".
+    const int64_t top_down_to_bottom_up = 14;
+    const int64_t bottom_up_to_top_down = 24;
+}
+
+size_t BoundaryGraph::parallel_level_min = 4096;
+
+BoundaryGraph::BoundaryGraph(Map &map) {
+    find_edges(map);
+    gen_graph(map.size(), map[0].size());
+    find_components();
+}
+
+bool BoundaryGraph::is_vertical_edge(const Vertex &v) {
+    return v.first->y == v.second->y;
+}
+
+bool BoundaryGraph::is_horisontal_edge(const Vertex &v) {
+    return v.first->x == v.second->x;
+}
+
+void BoundaryGraph::find_edges(Map &map) {
+
+    START()
+    const int sizex = map.size();
+    const int sizey = map[0].size();
+    words_per_row = (sizey + 63) / 64;
+    vertical_bits.assign((size_t)sizex * words_per_row, 0);
+    horisontal_bits.assign((size_t)sizex * words_per_row, 0);
+    word_first.assign((size_t)sizex * words_per_row, 0);
+
+    const unsigned threads = std::max(1u, std::min<unsigned>(threads_count(),
+                                                             sizex));
+    auto band_begin = [&](unsigned thread_idx) {
+        return (int)((int64_t)sizex * thread_idx / threads);
+    };
+
+    // Compare plate_ref of the row with the next row and with itself
+    // shifted by one. Rows are copied into flat buffers first, so the
+    // compare loops run over plain arrays and get vectorized.
+    std::vector<VertexId> band_edges(threads, 0);
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        // one more cell, so the last one has no horisontal edge
+        std::vector<int> cur(sizey + 1);
+        std::vector<int> next(sizey + 1);
+        auto load = [&](std::vector<int> &row, int x) {
+            for (int y = 0; y < sizey; y++) {
+                row[y] = map[x][y].plate_ref;
+            }
+            row[sizey] = row[sizey - 1];
+        };
+
+        const int begin = band_begin(thread_idx);
+        const int end = band_begin(thread_idx + 1);
+        if (begin < end) {
+            load(next, begin);
+        }
+        VertexId edges = 0;
+        for (int x = begin; x < end; x++) {
+            cur.swap(next);
+            if (x + 1 < sizex) {
+                load(next, x + 1);
+            } else {
+                next = cur;
+            }
+            uint64_t *v_bits = vertical_bits.data() + (size_t)x * words_per_row;
+            uint64_t *h_bits = horisontal_bits.data() + (size_t)x * words_per_row;
+            for (int w = 0; w < words_per_row; w++) {
+                const int y0 = w * 64;
+                const int len = std::min(64, sizey - y0);
+                uint64_t v = 0;
+                uint64_t h = 0;
+                for (int i = 0; i < len; i++) {
+                    v |= (uint64_t)(cur[y0 + i] != next[y0 + i]) << i;
+                    h |= (uint64_t)(cur[y0 + i] != cur[y0 + i + 1]) << i;
+                }
+                v_bits[w] = v;
+                h_bits[w] = h;
+                edges += std::popcount(v) + std::popcount(h);
+            }
+        }
+        band_edges[thread_idx] = edges;
+    });
+
+    VertexId total = 0;
+    for (VertexId &edges: band_edges) {
+        const VertexId first = total;
+        total += edges;
+        edges = first;
+    }
+    plates_edges.resize(total);
+
+    // Ids go by the lower voxel, vertical edge first, so walk set bits
+    // of both bitmaps together in the order of y.
+    std::vector<std::vector<VertexId>> band_map_edges(threads);
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        VertexId id = band_edges[thread_idx];
+        auto &found_map_edges = band_map_edges[thread_idx];
+        for (int x = band_begin(thread_idx); x < band_begin(thread_idx + 1);
+             x++) {
+            const size_t row = (size_t)x * words_per_row;
+            for (int w = 0; w < words_per_row; w++) {
+                word_first[row + w] = id;
+                const uint64_t v = vertical_bits[row + w];
+                const uint64_t h = horisontal_bits[row + w];
+                for (uint64_t bits = v | h; bits; bits &= bits - 1) {
+                    const int i = std::countr_zero(bits);
+                    const int y = w * 64 + i;
+                    Voxel *cur = &map[x][y];
+                    if (v >> i & 1) {
+                        if (y == 0 || y == sizey - 1) {
+                            found_map_edges.push_back(id);
+                        }
+                        plates_edges[id++] = {cur, &map[x + 1][y]};
+                    }
+                    if (h >> i & 1) {
+                        if (x == 0 || x == sizex - 1) {
+                            found_map_edges.push_back(id);
+                        }
+                        plates_edges[id++] = {cur, &map[x][y + 1]};
+                    }
+                }
+            }
+        }
+    });
+
+    map_edges.clear();
+    for (const auto &found: band_map_edges) {
+        map_edges.insert(map_edges.end(), found.begin(), found.end());
+    }
+    LOG_DEBUG(std::cout << "Edge len: " << plates_edges.size()
+                        << "\nMap edges: " << map_edges.size() << '\n';);
+}
+
+#ifdef DEBUG
+void BoundaryGraph::print_vertex(const Vertex &v) const {
+    LOG_DEBUG(std::cout << "{(" << v.first->x << ", " << v.first->y << "), ("
+                        << v.second->x << ", " << v.second->y << ")}";);
+}
+#endif
+
+void BoundaryGraph::gen_graph(int sizex, int sizey) {
+    START()
+
+    // Two edges are connected if they share a corner of the grid.
+    // Ids of the edges come from the bitmaps: id of the first edge in
+    // the word plus the number of edges before this bit in the word.
+    const VertexId vertex_cnt = plates_edges.size();
+
+    auto edge_id = [&](int x, int y, bool vertical) -> VertexId {
+        if (x < 0 || x >= sizex || y < 0 || y >= sizey) {
+            return -1;
+        }
+        const size_t word = (size_t)x * words_per_row + y / 64;
+        const int i = y % 64;
+        const uint64_t v = vertical_bits[word];
+        const uint64_t h = horisontal_bits[word];
+        if (!((vertical ? v : h) >> i & 1)) {
+            return -1;
+        }
+        const uint64_t below = (uint64_t(1) << i) - 1;
+        return word_first[word] + std::popcount(v & below) +
+               std::popcount(h & below) + (!vertical && (v >> i & 1));
+    };
+
+    auto vertical_id = [&](int x, int y) {
+        return edge_id(x, y, true);
+    };
+
+    auto horisontal_id = [&](int x, int y) {
+        return edge_id(x, y, false);
+    };
+
+    offsets.assign(vertex_cnt + 1, 0);
+    adjacency.clear();
+    adjacency.reserve(vertex_cnt * 4);
+
+    // Neighbours are kept in the same order, as the pairwise comparison
+    // of all edges gave them: first the lower ids, which found us, then
+    // the ones we found, then the higher ids, which found us.
+    // Thus BFS visits vertices in the same order and results are the same.
+    std::array<std::pair<int, VertexId>, 6> candidates;
+    int candidates_cnt = 0;
+    VertexId cur = 0;
+
+    auto add_neighbour = [&](VertexId to, bool found_by_cur) {
+        if (to < 0) {
+            return;
+        }
+        int group = found_by_cur ? 1 : (to < cur ? 0 : 2);
+        candidates[candidates_cnt++] = {group, to};
+    };
+
+    for (int x = 0; x < sizex; x++) {
+        for (; cur < vertex_cnt && plates_edges[cur].first->x == x; cur++) {
+            const int y = plates_edges[cur].first->y;
+            candidates_cnt = 0;
+            if (is_vertical_edge(plates_edges[cur])) {
+                add_neighbour(vertical_id(x, y + 1), true);
+                add_neighbour(horisontal_id(x + 1, y - 1), true);
+                add_neighbour(horisontal_id(x, y - 1), true);
+                add_neighbour(vertical_id(x, y - 1), false);
+                add_neighbour(horisontal_id(x, y), false);
+                add_neighbour(horisontal_id(x + 1, y), false);
+            } else {
+                add_neighbour(horisontal_id(x + 1, y), true);
+                add_neighbour(vertical_id(x, y), true);
+                add_neighbour(vertical_id(x - 1, y), true);
+                add_neighbour(horisontal_id(x - 1, y), false);
+                add_neighbour(vertical_id(x, y + 1), false);
+                add_neighbour(vertical_id(x - 1, y + 1), false);
+            }
+            std::sort(candidates.begin(), candidates.begin() + candidates_cnt);
+            for (int i = 0; i < candidates_cnt; i++) {
+                adjacency.emplace_back(candidates[i].second);
+            }
+            offsets[cur + 1] = adjacency.size();
+        }
+    }
+
+#ifdef DEBUG
+    LOG_DEBUG(std::cout << "Graph:\n";);
+    for (VertexId v = 0; v < vertex_cnt; v++) {
+        print_vertex(plates_edges[v]);
+        LOG_DEBUG(std::cout << ": ");
+        for (const VertexId to: neighbours(v)) {
+            print_vertex(plates_edges[to]);
+            LOG_DEBUG(std::cout << ", ");
+        }
+        LOG_DEBUG(std::cout << ";\n");
+    }
+#endif
+
+}
+
+void BoundaryGraph::find_components() {
+    START()
+    component_id.assign(vertex_cnt(), -1);
+    components = 0;
+    BfsState state;
+    state.resize(vertex_cnt());
+    for (VertexId v = 0; v < vertex_cnt(); v++) {
+        if (component_id[v] >= 0) {
+            continue;
+        }
+        bfs(v, state);
+        for (int32_t i = 0; i < state.visited; i++) {
+            component_id[state.queue[i]] = components;
+        }
+        components++;
+    }
+    LOG_DEBUG(std::cout << "Boundary components: " << components << '\n';);
+}
+
+std::vector<BoundaryGraph::Motion> BoundaryGraph::classify(
+        const std::vector<Plate> &plates) const {
+    START()
+    const VertexId cnt = vertex_cnt();
+    std::vector<Motion> motions(cnt);
+
+    const unsigned threads = threads_count();
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const VertexId begin = (int64_t)cnt * thread_idx / threads;
+        const VertexId end = (int64_t)cnt * (thread_idx + 1) / threads;
+        for (VertexId v = begin; v < end; v++) {
+            const Vertex &e = plates_edges[v];
+            const Plate &a = plates[e.first->plate_ref];
+            const Plate &b = plates[e.second->plate_ref];
+            // the second voxel is at +x or +y from the first one
+            const int dx = b.speedX - a.speedX;
+            const int dy = b.speedY - a.speedY;
+            const bool vertical = is_vertical_edge(e);
+            const int normal = vertical ? dx : dy;
+            const int tangential = vertical ? dy : dx;
+            if (std::abs(normal) <= std::abs(tangential)) {
+                motions[v] = Motion::transform;
+            } else if (normal > 0) {
+                motions[v] = Motion::divergent;
+            } else {
+                motions[v] = Motion::convergent;
+            }
+        }
+    });
+    return motions;
+}
+
+size_t BoundaryGraph::memory() const {
+    return plates_edges.capacity() * sizeof(Vertex) +
+           map_edges.capacity() * sizeof(VertexId) +
+           offsets.capacity() * sizeof(int32_t) +
+           adjacency.capacity() * sizeof(VertexId) +
+           vertical_bits.capacity() * sizeof(uint64_t) +
+           horisontal_bits.capacity() * sizeof(uint64_t) +
+           word_first.capacity() * sizeof(VertexId) +
+           component_id.capacity() * sizeof(int32_t);
+}
+
+void BoundaryGraph::BfsState::resize(VertexId vertex_cnt) {
+    distance.assign(vertex_cnt, -1);
+    queue.assign(vertex_cnt, 0);
+    visited = 0;
+}
+
+size_t BoundaryGraph::BfsState::memory() const {
+    size_t res = distance.capacity() * sizeof(int32_t) +
+                 queue.capacity() * sizeof(VertexId) +
+                 frontier.capacity() * sizeof(uint64_t);
+    for (const auto &f: found) {
+        res += f.capacity() * sizeof(VertexId);
+    }
+    return res;
+}
+
+BoundaryGraph::VertexId BoundaryGraph::bfs(VertexId start,
+                                           BfsState &state) const {
+    START()
+    std::vector<int32_t> &distance = state.distance;
+    std::vector<VertexId> &queue = state.queue;
+    for (int32_t i = 0; i < state.visited; i++) {
+        distance[queue[i]] = -1;
+    }
+
+    // Every vertex gets into the queue at most once,
+    // so the flat buffer of vertex_cnt elements never overflows.
+    size_t head = 0;
+    size_t tail = 0;
+    queue[tail++] = start;
+    VertexId far = start;
+    distance[start] = 0;
+    while (head != tail) {
+        VertexId cur = queue[head++];
+        const int32_t next_distance = distance[cur] + 1;
+
+        for (const VertexId to: neighbours(cur)) {
+            if (distance[to] < 0) {
+                distance[to] = next_distance;
+                far = to;
+                queue[tail++] = to;
+            }
+        }
+    }
+    state.visited = tail;
+    return far;
+}
+
+BoundaryGraph::VertexId BoundaryGraph::parallel_bfs(VertexId start,
+                                                    BfsState &state) const {
+    START()
+    // Level-synchronous BFS, which switches between top-down and bottom-up
+    // steps. Levels are kept one after another in the queue, as in bfs.
+    // Top-down: threads split the level and claim unvisited neighbours
+    // with CAS. Bottom-up: threads split the vertices and every unvisited
+    // one looks for a neighbour in the frontier bitmap, which is cheaper
+    // when the frontier has more edges than the unvisited part.
+    // Boundary graphs are path-like, so the most of levels are narrow,
+    // they are expanded by the calling thread only.
+    const VertexId n = vertex_cnt();
+    const unsigned threads = threads_count();
+    std::vector<int32_t> &distance = state.distance;
+    std::vector<VertexId> &queue = state.queue;
+    for (int32_t i = 0; i < state.visited; i++) {
+        distance[queue[i]] = -1;
+    }
+    state.found.resize(threads);
+    state.frontier.resize((n + 63) / 64);
+
+    queue[0] = start;
+    distance[start] = 0;
+    size_t level_begin = 0;
+    size_t level_end = 1;
+    int32_t level = 0;
+    int64_t frontier_edges = neighbours(start).size();
+    int64_t unexplored_edges = adjacency.size() - frontier_edges;
+    bool bottom_up = false;
+
+    // Append vertices, found by threads, as the next level.
+    auto collect_found = [&](size_t tail) {
+        for (unsigned t = 0; t < threads; t++) {
+            std::copy(state.found[t].begin(), state.found[t].end(),
+                      queue.begin() + tail);
+            tail += state.found[t].size();
+            state.found[t].clear();
+        }
+        return tail;
+    };
+
+    auto top_down = [&](unsigned t) {
+        const size_t width = level_end - level_begin;
+        const size_t begin = level_begin + width * t / threads;
+        const size_t end = level_begin + width * (t + 1) / threads;
+        for (size_t i = begin; i < end; i++) {
+            for (const VertexId to: neighbours(queue[i])) {
+                std::atomic_ref<int32_t> d(distance[to]);
+                int32_t unvisited = -1;
+                if (d.load(std::memory_order_relaxed) < 0 &&
+                    d.compare_exchange_strong(unvisited, level + 1,
+                                              std::memory_order_relaxed)) {
+                    state.found[t].emplace_back(to);
+                }
+            }
+        }
+    };
+
+    auto clear_frontier = [&](unsigned t) {
+        const size_t words = state.frontier.size();
+        std::fill(state.frontier.begin() + words * t / threads,
+                  state.frontier.begin() + words * (t + 1) / threads, 0);
+    };
+
+    auto mark_frontier = [&](unsigned t) {
+        const size_t width = level_end - level_begin;
+        const size_t begin = level_begin + width * t / threads;
+        const size_t end = level_begin + width * (t + 1) / threads;
+        for (size_t i = begin; i < end; i++) {
+            std::atomic_ref<uint64_t> word(state.frontier[queue[i] / 64]);
+            word.fetch_or(1ull << (queue[i] % 64), std::memory_order_relaxed);
+        }
+    };
+
+    auto in_frontier = [&](VertexId v) {
+        return state.frontier[v / 64] >> (v % 64) & 1;
+    };
+
+    auto bottom_up_step = [&](unsigned t) {
+        const VertexId begin = (int64_t)n * t / threads;
+        const VertexId end = (int64_t)n * (t + 1) / threads;
+        for (VertexId v = begin; v < end; v++) {
+            if (distance[v] >= 0) {
+                continue;
+            }
+            for (const VertexId from: neighbours(v)) {
+                if (in_frontier(from)) {
+                    distance[v] = level + 1;
+                    state.found[t].emplace_back(v);
+                    break;
+                }
+            }
+        }
+    };
+
+    // Chooses the step of the current level, true if the threads do it.
+    auto choose_step = [&]() {
+        const size_t width = level_end - level_begin;
+        if (!bottom_up && width >= parallel_level_min &&
+            frontier_edges > unexplored_edges / top_down_to_bottom_up) {
+            bottom_up = true;
+        } else if (bottom_up &&
+                   (int64_t)width < n / bottom_up_to_top_down) {
+            bottom_up = false;
+        }
+        return bottom_up || (width >= parallel_level_min && threads > 1);
+    };
+
+    // Makes queue[level_end..tail) the next level, false if it is empty.
+    auto next_level = [&](size_t tail) {
+        if (tail == level_end) {
+            return false;
+        }
+        frontier_edges = 0;
+        for (size_t i = level_end; i < tail; i++) {
+            frontier_edges += offsets[queue[i] + 1] - offsets[queue[i]];
+        }
+        unexplored_edges -= frontier_edges;
+        level_begin = level_end;
+        level_end = tail;
+        level++;
+        return true;
+    };
+
+    bool finished = false;
+    while (!finished) {
+        if (!choose_step()) {
+            size_t tail = level_end;
+            for (size_t i = level_begin; i < level_end; i++) {
+                for (const VertexId to: neighbours(queue[i])) {
+                    if (distance[to] < 0) {
+                        distance[to] = level + 1;
+                        queue[tail++] = to;
+                    }
+                }
+            }
+            finished = !next_level(tail);
+            continue;
+        }
+
+        // The threads are started once for a run of wide levels and meet
+        // on the barriers, the last one to arrive at the end of a level
+        // collects it and chooses the next step.
+        bool wide = true;
+        auto end_level = [&]() noexcept {
+            finished = !next_level(collect_found(level_end));
+            wide = !finished && choose_step();
+        };
+        std::barrier step_done(threads);
+        std::barrier level_done(threads, end_level);
+        run_in_parallel(threads, [&](unsigned t) {
+            while (wide) {
+                if (bottom_up) {
+                    clear_frontier(t);
+                    step_done.arrive_and_wait();
+                    mark_frontier(t);
+                    step_done.arrive_and_wait();
+                    bottom_up_step(t);
+                } else {
+                    top_down(t);
+                }
+                level_done.arrive_and_wait();
+            }
+        });
+    }
+
+    state.visited = level_end;
+    return *std::min_element(queue.begin() + level_begin,
+                             queue.begin() + level_end);
+}
@@ -0,0 +1,116 @@
+#ifndef BOUNDARY_GRAPH_H
+#define BOUNDARY_GRAPH_H
+
+#include <vector>
+#include <span>
+#include <utility>
+#include <cstdint>
+#include "common.h"
+
+namespace generation {
+
+/*
+Graph of the plate boundaries. Vertex is a pair of neighbour voxels
+from different plates, two vertices are connected, if these boundary
+segments share a corner of the grid.
+It depends on plate_ref only, so Generator builds it once after split_map
+and all the elements share it.
+*/
+class BoundaryGraph final {
+public:
+    using Vertex = std::pair<Voxel*, Voxel*>;
+    // Dense id of a boundary edge, index into plates_edges.
+    using VertexId = int32_t;
+
+    // BFS work buffers, sized once to the number of vertices.
+    // Only the vertices visited by the previous run are reset,
+    // so BFS costs O(component), not O(graph).
+    struct BfsState {
+        std::vector<int32_t> distance;
+        std::vector<VertexId> queue;
+        // -1 means all the distances have to be reset.
+        int32_t visited = 0;
+
+        // parallel_bfs only: frontier bitmap and
+        // vertices found by every thread on the current level.
+        std::vector<uint64_t> frontier;
+        std::vector<std::vector<VertexId>> found;
+
+        void resize(VertexId vertex_cnt);
+        size_t memory() const;
+    };
+
+    // Relative motion of the plates along a boundary edge.
+    enum class Motion : uint8_t {
+        divergent,
+        convergent,
+        transform
+    };
+    static const int motions_cnt = 3;
+
+    BoundaryGraph(Map &map);
+
+    VertexId vertex_cnt() const { return plates_edges.size(); }
+    const Vertex& vertex(VertexId v) const { return plates_edges[v]; }
+    const std::vector<VertexId>& get_map_edges() const { return map_edges; }
+    std::span<const VertexId> neighbours(VertexId v) const {
+        return {adjacency.data() + offsets[v], adjacency.data() + offsets[v + 1]};
+    }
+    // Connected components, numbered in the order of their lowest vertex.
+    int32_t components_cnt() const { return components; }
+    int32_t component(VertexId v) const { return component_id[v]; }
+
+    // Both return the farthest vertex from start and leave distances
+    // in the state. bfs returns the last visited one, parallel_bfs the one
+    // with the smallest id, the distances are the same.
+    VertexId bfs(VertexId start, BfsState &state) const;
+    VertexId parallel_bfs(VertexId start, BfsState &state) const;
+
+    // Motion of every edge from the plates velocities: normal part of
+    // the relative velocity against the tangential one. Edge ids are
+    // the ranks of the set bits of the boundary bitmaps, so the pass over
+    // the edges is the pass over the bitmaps without the empty words.
+    std::vector<Motion> classify(const std::vector<Plate> &plates) const;
+
+    // Memory held by the edges, bitmaps, CSR arrays and components, in bytes.
+    size_t memory() const;
+
+    static bool is_vertical_edge(const Vertex &v);
+    static bool is_horisontal_edge(const Vertex &v);
+
+    // Levels with less vertices are done by a single thread
+    // in parallel_bfs, it isn't worth to wake up the others.
+    static size_t parallel_level_min;
+
+private:
+    void find_edges(Map &map);
+    void gen_graph(int sizex, int sizey);
+    void find_components();
+#ifdef DEBUG
+    void print_vertex(const Vertex &v) const;
+#endif
+
+    // we gonna look for the longest path between these vertices
+    std::vector<VertexId> map_edges;
+    // All boundary edges, ordered by the lower voxel (x, then y),
+    // vertical edge before horisontal one.
+    std::vector<Vertex> plates_edges;
+    // Boundary bitmaps, words_per_row words for every map row x.
+    // Bit y is set if voxel (x, y) is on another plate than (x + 1, y)
+    // in vertical_bits, than (x, y + 1) in horisontal_bits.
+    int32_t words_per_row = 0;
+    std::vector<uint64_t> vertical_bits;
+    std::vector<uint64_t> horisontal_bits;
+    // Id of the first edge in every word of the bitmaps.
+    std::vector<VertexId> word_first;
+    // Compressed sparse row form:
+    // neighbours of v are adjacency[offsets[v]..offsets[v+1]).
+    std::vector<int32_t> offsets;
+    std::vector<VertexId> adjacency;
+    std::vector<int32_t> component_id;
+    int32_t components = 0;
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <cstdint>
+#include <string_view>
 
 struct Plate final {
     int speedX;
@@ -18,6 +19,29 @@ struct Voxel final {
     uint8_t color;
 };
 
+enum class NoiseType {
+	perlin,
+	fbm,
+	ridged,
+	// integer perlin, the same on every build
+	fixed,
+	// power-law spectrum through the FFT
+	spectral
+};
+
+enum class ExportMode {
+	// every column is solid from z = 0
+	solid,
+	// voxels with an open face only
+	shell
+};
+
+enum class LodFilter {
+	mean,
+	max,
+	min
+};
+
 struct GenParams final {
 	int sizex;
 	int sizey;
@@ -26,6 +50,24 @@ struct GenParams final {
 	int basin_cnt;
 	int margin_cnt;
 	std::string_view file;
+	int seed = -1;
+	int noise_stride = 1;
+	NoiseType noise_type = NoiseType::perlin;
+	int noise_octaves = 3;
+	float noise_gain = 0.5f;
+	float noise_lacunarity = 2.0f;
+	float noise_slope = 2.0f;
+	// the height noise doesn't follow seed, the same relief
+	// goes with all the plate layouts
+	int noise_seed = 1337;
+	ExportMode export_mode = ExportMode::solid;
+	// a .vox every keyframe_years of the simulation, 0 for none
+	int keyframe_years = 0;
+	// the export split into shard_size x shard_size regions, 0 for one file
+	int shard_size = 0;
+	// the export downsampled by 2^export_lod with lod_filter
+	int export_lod = 0;
+	LodFilter lod_filter = LodFilter::mean;
 };
 
 using Map = std::vector<std::vector<Voxel>>;
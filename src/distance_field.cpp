@@ -0,0 +1,254 @@
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include "distance_field.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace generation;
+using namespace utils;
+
+namespace {
+    int64_t floor_div(int64_t a, int64_t b) {
+        return a / b - (a % b != 0 && (a < 0) != (b < 0));
+    }
+
+    // 1D Manhattan transform, rows of the nearest site go to from.
+    void manhattan_1d(const int64_t *f, int n, int64_t *d, int32_t *from) {
+        const int64_t inf = DistanceField::infinity;
+        int64_t best = inf;
+        int32_t best_from = -1;
+        for (int u = 0; u < n; u++) {
+            const int64_t moved = best == inf ? inf : best + 1;
+            if (f[u] <= moved && f[u] != inf) {
+                best = f[u];
+                best_from = u;
+            } else {
+                best = moved;
+            }
+            d[u] = best;
+            from[u] = best_from;
+        }
+        best = inf;
+        best_from = -1;
+        for (int u = n - 1; u >= 0; u--) {
+            const int64_t moved = best == inf ? inf : best + 1;
+            if (f[u] <= moved && f[u] != inf) {
+                best = f[u];
+                best_from = u;
+            } else {
+                best = moved;
+            }
+            // forward pass wins ties
+            if (best < d[u]) {
+                d[u] = best;
+                from[u] = best_from;
+            }
+        }
+    }
+
+    // 1D squared Euclidean transform, f is the distance along the row,
+    // lower envelope of parabolas (u - site)^2 + f(site)^2.
+    void euclidean_1d(const int64_t *f, int n, int64_t *d, int32_t *from,
+                      int32_t *sites, int32_t *starts) {
+        const int64_t inf = DistanceField::infinity;
+        auto parabola = [&](int64_t u, int64_t site) {
+            return (u - site) * (u - site) + f[site] * f[site];
+        };
+        // the first u, where site u is not worse than site i
+        auto separator = [&](int64_t i, int64_t u) {
+            return floor_div(u * u - i * i + f[u] * f[u] - f[i] * f[i],
+                             2 * (u - i));
+        };
+
+        int k = -1;
+        for (int u = 0; u < n; u++) {
+            if (f[u] == inf) {
+                continue;
+            }
+            while (k >= 0 &&
+                   parabola(starts[k], sites[k]) > parabola(starts[k], u)) {
+                k--;
+            }
+            if (k < 0) {
+                k = 0;
+                sites[0] = u;
+                starts[0] = 0;
+            } else {
+                const int64_t start = 1 + separator(sites[k], u);
+                if (start < n) {
+                    k++;
+                    sites[k] = u;
+                    starts[k] = start;
+                }
+            }
+        }
+
+        for (int u = n - 1; u >= 0; u--) {
+            if (k < 0) {
+                d[u] = inf;
+                from[u] = -1;
+                continue;
+            }
+            d[u] = parabola(u, sites[k]);
+            from[u] = sites[k];
+            if (u == starts[k]) {
+                k--;
+            }
+        }
+    }
+}
+
+DistanceField::DistanceField(int sizex, int sizey,
+                             const std::vector<uint8_t> &seeds,
+                             Metric metric):
+    sizex(sizex), sizey(sizey), metric(metric) {
+    START()
+    transform_rows(seeds);
+    transform_columns();
+}
+
+std::vector<uint8_t> DistanceField::find_seeds(const Map &map,
+                                               unsigned boundaries) {
+    START()
+    const int sizex = map.size();
+    const int sizey = map[0].size();
+    std::vector<uint8_t> seeds((size_t)sizex * sizey);
+
+    const unsigned threads = threads_count();
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const auto [begin, end] = thread_range(sizex, thread_idx, threads);
+        for (int x = begin; x < end; x++) {
+            for (int y = 0; y < sizey; y++) {
+                bool seed = false;
+                if (boundaries & map_boundary) {
+                    seed = x == 0 || y == 0 ||
+                           x == sizex - 1 || y == sizey - 1;
+                }
+                if (!seed && (boundaries & plates_boundary)) {
+                    const int plate = map[x][y].plate_ref;
+                    seed = (x > 0 && map[x - 1][y].plate_ref != plate) ||
+                           (y > 0 && map[x][y - 1].plate_ref != plate) ||
+                           (x < sizex - 1 &&
+                            map[x + 1][y].plate_ref != plate) ||
+                           (y < sizey - 1 &&
+                            map[x][y + 1].plate_ref != plate);
+                }
+                seeds[(size_t)x * sizey + y] = seed;
+            }
+        }
+    });
+    return seeds;
+}
+
+void DistanceField::transform_rows(const std::vector<uint8_t> &seeds) {
+    START()
+    // Not zero filled, every thread touches its own rows first.
+    dist.reset(new int64_t[(size_t)sizex * sizey]);
+    nearest_seed.reset(new int32_t[(size_t)sizex * sizey]);
+
+    const unsigned threads = threads_count();
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const auto [begin, end] = thread_range(sizex, thread_idx, threads);
+        for (int x = begin; x < end; x++) {
+            const uint8_t *row_seeds = seeds.data() + index(x, 0);
+            int64_t *row_dist = dist.get() + index(x, 0);
+            int32_t *row_seed = nearest_seed.get() + index(x, 0);
+
+            int32_t last = -1;
+            for (int y = 0; y < sizey; y++) {
+                if (row_seeds[y]) {
+                    last = y;
+                }
+                row_seed[y] = last;
+            }
+            int32_t next = -1;
+            for (int y = sizey - 1; y >= 0; y--) {
+                if (row_seeds[y]) {
+                    next = y;
+                }
+                const int32_t prev = row_seed[y];
+                const int64_t to_prev = prev < 0 ? infinity : y - prev;
+                const int64_t to_next = next < 0 ? infinity : next - y;
+                if (to_next < to_prev) {
+                    row_dist[y] = to_next;
+                    row_seed[y] = next;
+                } else {
+                    row_dist[y] = to_prev;
+                }
+            }
+        }
+    });
+}
+
+void DistanceField::transform_columns() {
+    START()
+    const unsigned threads = threads_count();
+    const int blocks = (sizey + columns_block - 1) / columns_block;
+
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        // Block columns are copied out, transformed and copied back,
+        // reading and writing goes row by row.
+        std::vector<int64_t> f((size_t)columns_block * sizex);
+        std::vector<int32_t> seed_y((size_t)columns_block * sizex);
+        std::vector<int64_t> d(sizex);
+        std::vector<int32_t> from(sizex);
+        std::vector<int32_t> sites(sizex);
+        std::vector<int32_t> starts(sizex);
+
+        const auto [begin, end] = thread_range(blocks, thread_idx, threads);
+        for (int block = begin; block < end; block++) {
+            const int y0 = block * columns_block;
+            const int width = std::min(columns_block, sizey - y0);
+
+            for (int x = 0; x < sizex; x++) {
+                const int64_t *row_dist = dist.get() + index(x, y0);
+                const int32_t *row_seed = nearest_seed.get() + index(x, y0);
+                for (int c = 0; c < width; c++) {
+                    f[(size_t)c * sizex + x] = row_dist[c];
+                    seed_y[(size_t)c * sizex + x] = row_seed[c];
+                }
+            }
+
+            for (int c = 0; c < width; c++) {
+                const int64_t *column_f = f.data() + (size_t)c * sizex;
+                if (metric == Metric::manhattan) {
+                    manhattan_1d(column_f, sizex, d.data(), from.data());
+                } else {
+                    euclidean_1d(column_f, sizex, d.data(), from.data(),
+                                 sites.data(), starts.data());
+                }
+                // Input of the column is not needed anymore,
+                // keep the result there until the block is written back.
+                int32_t *column_seed = seed_y.data() + (size_t)c * sizex;
+                for (int x = 0; x < sizex; x++) {
+                    const int32_t r = from[x];
+                    from[x] = r < 0 ? -1 : index(r, column_seed[r]);
+                }
+                std::copy(d.begin(), d.end(), f.data() + (size_t)c * sizex);
+                std::copy(from.begin(), from.end(), column_seed);
+            }
+
+            for (int x = 0; x < sizex; x++) {
+                int64_t *row_dist = dist.get() + index(x, y0);
+                int32_t *row_seed = nearest_seed.get() + index(x, y0);
+                for (int c = 0; c < width; c++) {
+                    row_dist[c] = f[(size_t)c * sizex + x];
+                    row_seed[c] = seed_y[(size_t)c * sizex + x];
+                }
+            }
+        }
+    });
+}
+
+double DistanceField::distance(int x, int y) const {
+    const int64_t raw = raw_distance(x, y);
+    if (raw == infinity) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return metric == Metric::manhattan ? raw : std::sqrt((double)raw);
+}
+
+size_t DistanceField::memory() const {
+    return (size_t)sizex * sizey * (sizeof(int64_t) + sizeof(int32_t));
+}
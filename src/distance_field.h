@@ -0,0 +1,69 @@
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "common.h"
+
+namespace generation {
+
+/*
+Exact distance transform of the grid: distance from every cell to the
+nearest seed cell and the seed itself. Cells are indexed x * sizey + y,
+like the map.
+Two separable passes (Meijster et al.): along y in every row, then
+along x in every column, both are parallel, O(cells) in total.
+*/
+class DistanceField final {
+public:
+    enum class Metric {
+        manhattan,
+        euclidean
+    };
+
+    // Boundaries the distances are measured from, can be combined.
+    enum Boundary : unsigned {
+        // cells with a neighbour from another plate
+        plates_boundary = 1u << 0,
+        // cells on the map edge
+        map_boundary = 1u << 1
+    };
+
+    static const int64_t infinity = INT64_MAX;
+
+    // seeds[x * sizey + y] != 0 marks a seed cell.
+    DistanceField(int sizex, int sizey,
+                  const std::vector<uint8_t> &seeds, Metric metric);
+
+    static std::vector<uint8_t> find_seeds(const Map &map, unsigned boundaries);
+
+    // Manhattan distance, or squared Euclidean one, which does not fit
+    // int32_t on maps with more than 32k cells per side,
+    // infinity if there are no seeds at all.
+    int64_t raw_distance(int x, int y) const { return dist[index(x, y)]; }
+    double distance(int x, int y) const;
+    // Index of the nearest seed, -1 if there are no seeds at all.
+    // Fits while the grid has less than 2^31 cells.
+    int32_t nearest(int x, int y) const { return nearest_seed[index(x, y)]; }
+
+    Metric get_metric() const { return metric; }
+    size_t memory() const;
+
+private:
+    size_t index(int x, int y) const { return (size_t)x * sizey + y; }
+    void transform_rows(const std::vector<uint8_t> &seeds);
+    void transform_columns();
+
+    int sizex;
+    int sizey;
+    Metric metric;
+    // After the first pass: distance along the row and y of the seed,
+    // after the second one: the result and the seed index.
+    std::unique_ptr<int64_t[]> dist;
+    std::unique_ptr<int32_t[]> nearest_seed;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+#include <cmath>
+#include <algorithm>
+#include <numbers>
+#include "fft.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace utils;
+
+FFT2D::Plan::Plan(int n): n(n), reversed(n), twiddles(n / 2) {
+    int bits = 0;
+    while ((1 << bits) < n) {
+        bits++;
+    }
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        reversed[i] = r;
+    }
+    // In double, so the twiddles of big sizes stay exact to float.
+    for (int k = 0; k < n / 2; k++) {
+        const double angle = -2 * std::numbers::pi * k / n;
+        twiddles[k] = {(float)std::cos(angle), (float)std::sin(angle)};
+    }
+}
+
+void FFT2D::Plan::run(std::complex<float> *a, bool inverse) const {
+    for (int i = 0; i < n; i++) {
+        if (i < reversed[i]) {
+            std::swap(a[i], a[reversed[i]]);
+        }
+    }
+    // conjugate twiddles for the inverse transform
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (int len = 2; len <= n; len *= 2) {
+        const int half = len / 2;
+        const int step = n / len;
+        for (int begin = 0; begin < n; begin += len) {
+            std::complex<float> *lo = a + begin;
+            std::complex<float> *hi = lo + half;
+            for (int j = 0; j < half; j++) {
+                const float w_re = twiddles[j * step].real();
+                const float w_im = twiddles[j * step].imag() * sign;
+                // by hand, std::complex operator* checks for nans
+                const float re = hi[j].real() * w_re - hi[j].imag() * w_im;
+                const float im = hi[j].real() * w_im + hi[j].imag() * w_re;
+                const std::complex<float> t {re, im};
+                hi[j] = lo[j] - t;
+                lo[j] += t;
+            }
+        }
+    }
+}
+
+FFT2D::FFT2D(int rows, int columns):
+    rows(rows), columns(columns), row_plan(columns / 2), column_plan(rows),
+    row_twiddles(columns / 2) {
+    for (int k = 0; k < columns / 2; k++) {
+        const double angle = 2 * std::numbers::pi * k / columns;
+        row_twiddles[k] = {(float)std::cos(angle), (float)std::sin(angle)};
+    }
+}
+
+void FFT2D::inverse_real(std::complex<float> *data) const {
+    START()
+    transform_columns(data);
+    real_rows(data);
+}
+
+void FFT2D::transform_columns(std::complex<float> *data) const {
+    const unsigned threads = threads_count();
+    const int width_total = stride();
+    const int blocks = (width_total + columns_block - 1) / columns_block;
+
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        std::vector<std::complex<float>> block_data(
+            (size_t)columns_block * rows);
+        const auto [begin, end] = thread_range(blocks, thread_idx, threads);
+        for (int block = begin; block < end; block++) {
+            const int c0 = block * columns_block;
+            const int width = std::min(columns_block, width_total - c0);
+
+            for (int r = 0; r < rows; r++) {
+                const std::complex<float> *row =
+                    data + (size_t)r * width_total + c0;
+                for (int c = 0; c < width; c++) {
+                    block_data[(size_t)c * rows + r] = row[c];
+                }
+            }
+            for (int c = 0; c < width; c++) {
+                column_plan.run(block_data.data() + (size_t)c * rows, true);
+            }
+            for (int r = 0; r < rows; r++) {
+                std::complex<float> *row = data + (size_t)r * width_total + c0;
+                for (int c = 0; c < width; c++) {
+                    row[c] = block_data[(size_t)c * rows + r];
+                }
+            }
+        }
+    });
+}
+
+void FFT2D::real_rows(std::complex<float> *data) const {
+    // With m = columns / 2 and bins X[0..m], z[j] = x[2j] + i x[2j+1] is
+    // the inverse FFT of the size m of
+    //   Z[k] = E[k] + i O[k], E[k] = X[k] + conj(X[m - k]),
+    //   O[k] = (X[k] - conj(X[m - k])) exp(2 pi i k / columns),
+    // as X[k + m] = conj(X[m - k]) for the real x.
+    const int m = columns / 2;
+    auto packed = [&](std::complex<float> a, std::complex<float> b, int k) {
+        const std::complex<float> b_conj = std::conj(b);
+        const std::complex<float> e = a + b_conj;
+        const std::complex<float> d = a - b_conj;
+        const float w_re = row_twiddles[k].real();
+        const float w_im = row_twiddles[k].imag();
+        // by hand, std::complex operator* checks for nans
+        const float o_re = d.real() * w_re - d.imag() * w_im;
+        const float o_im = d.real() * w_im + d.imag() * w_re;
+        return std::complex<float>{e.real() - o_im, e.imag() + o_re};
+    };
+
+    const unsigned threads = threads_count();
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const auto [begin, end] = thread_range(rows, thread_idx, threads);
+        for (int r = begin; r < end; r++) {
+            std::complex<float> *x = data + (size_t)r * stride();
+            // Z[k] and Z[m - k] use the same pair of bins
+            for (int k = 0; k <= m / 2; k++) {
+                const std::complex<float> a = x[k];
+                const std::complex<float> b = x[m - k];
+                x[k] = packed(a, b, k);
+                if (k > 0 && k < m - k) {
+                    x[m - k] = packed(b, a, m - k);
+                }
+            }
+            row_plan.run(x, true);
+        }
+    });
+}
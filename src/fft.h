@@ -0,0 +1,58 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <complex>
+#include <cstdint>
+
+namespace utils {
+
+/*
+Inverse 2D FFT of a real rows x columns grid from its half spectrum,
+both sizes are powers of two, columns >= 2. Bins are
+data[row * stride() + k] for k <= columns / 2, the other half is
+Hermitian, so it isn't stored.
+Iterative radix-2 along the columns of the half spectrum: they are
+copied out by blocks, transformed contiguously and copied back, so
+reading and writing goes row by row. Then every row is an inverse real
+transform: pairs of real values are packed into one complex, so it is
+a complex FFT of columns / 2. Both passes are parallel.
+The result replaces the bins: value y of a row is the real part of
+data[row * stride() + y / 2] for even y, the imaginary part for odd y.
+Not scaled, as the sum over all columns * rows bins.
+*/
+class FFT2D final {
+public:
+    FFT2D(int rows, int columns);
+
+    void inverse_real(std::complex<float> *data) const;
+
+    // Complex bins of a row, columns / 2 + 1.
+    int stride() const { return columns / 2 + 1; }
+
+private:
+    // 1D complex transform of the size n.
+    struct Plan {
+        explicit Plan(int n);
+        void run(std::complex<float> *a, bool inverse) const;
+
+        int n;
+        std::vector<int32_t> reversed;
+        // exp(-2 pi i k / n), k < n / 2
+        std::vector<std::complex<float>> twiddles;
+    };
+
+    void transform_columns(std::complex<float> *data) const;
+    void real_rows(std::complex<float> *data) const;
+
+    int rows;
+    int columns;
+    Plan row_plan;
+    Plan column_plan;
+    // exp(2 pi i k / columns), k < columns / 2, unpack odd values
+    std::vector<std::complex<float>> row_twiddles;
+};
+
+}
+
+#endif
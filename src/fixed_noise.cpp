@@ -0,0 +1,254 @@
+#include <algorithm>
+#include "fixed_noise.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FIXED_NOISE_X86
+#include <immintrin.h>
+#endif
+
+using namespace Noise;
+
+namespace {
+    const uint32_t prime_x = 501125321u;
+    const uint32_t prime_y = 1136930381u;
+    const uint32_t hash_mul = 0x27d4eb2du;
+    const int bits = FixedNoise::fraction_bits;
+    const int32_t one = FixedNoise::one;
+
+    // 6t^5 - 15t^4 + 10t^3 of the Q14 fraction, exact in int64.
+    int32_t fade(int64_t t) {
+        const int64_t s = one;
+        int64_t res = (6 * t - 15 * s) * t + 10 * s * s;
+        res = res * t / s;
+        res = res * t / s;
+        res = res * t / s;
+        return res / (s * s);
+    }
+
+    // Dot product with the diagonal gradient of the hash.
+    int32_t gradient(uint32_t hash, int32_t dx, int32_t dy) {
+        hash *= hash_mul;
+        hash ^= hash >> 15;
+        const int32_t mask_x = -(int32_t)(hash & 1);
+        const int32_t mask_y = -(int32_t)((hash >> 1) & 1);
+        return ((dx ^ mask_x) - mask_x) + ((dy ^ mask_y) - mask_y);
+    }
+
+    int32_t lerp(int32_t a, int32_t b, int32_t t) {
+        return a + (((b - a) * t) >> bits);
+    }
+
+    // Values of the diagonal gradients are in -2 * one..2 * one.
+    int32_t to_height(int32_t value, int32_t noise_min, int32_t range) {
+        value = std::clamp(value, -2 * one, 2 * one);
+        return noise_min + (((value + 2 * one) * range) >> (bits + 2));
+    }
+}
+
+FixedNoise::FixedNoise(int noise_min, int noise_max, int sizey,
+                       int period, uint32_t seed):
+    noise_min(noise_min), noise_max(noise_max), period(period), seed(seed),
+    kernel(best_kernel()),
+    cell_y(sizey), fraction_y(sizey), fade_y(sizey) {
+    for (int y = 0; y < sizey; y++) {
+        cell_y[y] = (uint32_t)(y / period) * prime_y;
+        fraction_y[y] = (int64_t)(y % period) * one / period;
+        fade_y[y] = fade(fraction_y[y]);
+    }
+}
+
+FixedNoise::Kernel FixedNoise::best_kernel() {
+#ifdef FIXED_NOISE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernel::avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return Kernel::sse;
+    }
+#endif
+    return Kernel::scalar;
+}
+
+FixedNoise::Row FixedNoise::row(int x) const {
+    const int32_t fraction = (int64_t)(x % period) * one / period;
+    return {(int32_t)(x / period), fraction, fade(fraction)};
+}
+
+int32_t FixedNoise::value(int x, int y) const {
+    const Row r = row(x);
+    const uint32_t x0 = seed ^ ((uint32_t)r.cell * prime_x);
+    const uint32_t x1 = seed ^ ((uint32_t)(r.cell + 1) * prime_x);
+    const uint32_t y0 = cell_y[y];
+    const uint32_t y1 = y0 + prime_y;
+    const int32_t dx = r.fraction;
+    const int32_t dy = fraction_y[y];
+    const int32_t a = lerp(gradient(x0 ^ y0, dx, dy),
+                           gradient(x1 ^ y0, dx - one, dy), r.fade);
+    const int32_t b = lerp(gradient(x0 ^ y1, dx, dy - one),
+                           gradient(x1 ^ y1, dx - one, dy - one), r.fade);
+    return lerp(a, b, fade_y[y]);
+}
+
+void FixedNoise::heights(int x, int y_begin, int y_end, int32_t *out,
+                         Kernel kernel) const {
+    if (kernel == Kernel::best) {
+        kernel = this->kernel;
+    }
+    const Row r = row(x);
+    switch (kernel) {
+#ifdef FIXED_NOISE_X86
+    case Kernel::avx2:
+        heights_avx2(r, y_begin, y_end, out);
+        break;
+    case Kernel::sse:
+        heights_sse(r, y_begin, y_end, out);
+        break;
+#endif
+    default:
+        heights_scalar(r, y_begin, y_end, out);
+    }
+}
+
+void FixedNoise::heights_scalar(const Row &r, int y_begin, int y_end,
+                                int32_t *out) const {
+    const uint32_t x0 = seed ^ ((uint32_t)r.cell * prime_x);
+    const uint32_t x1 = seed ^ ((uint32_t)(r.cell + 1) * prime_x);
+    const int32_t dx = r.fraction;
+    const int32_t range = noise_max - noise_min;
+    for (int y = y_begin; y < y_end; y++) {
+        const uint32_t y0 = cell_y[y];
+        const uint32_t y1 = y0 + prime_y;
+        const int32_t dy = fraction_y[y];
+        const int32_t a = lerp(gradient(x0 ^ y0, dx, dy),
+                               gradient(x1 ^ y0, dx - one, dy), r.fade);
+        const int32_t b = lerp(gradient(x0 ^ y1, dx, dy - one),
+                               gradient(x1 ^ y1, dx - one, dy - one), r.fade);
+        *out++ = to_height(lerp(a, b, fade_y[y]), noise_min, range);
+    }
+}
+
+#ifdef FIXED_NOISE_X86
+
+// The same steps as the scalar loop, 4 or 8 cells at once, the tail
+// goes to the scalar loop.
+
+namespace {
+    __attribute__((target("sse4.1")))
+    __m128i gradient_sse(__m128i hash, __m128i dx, __m128i dy) {
+        hash = _mm_mullo_epi32(hash, _mm_set1_epi32(hash_mul));
+        hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+        const __m128i bit = _mm_set1_epi32(1);
+        const __m128i mask_x = _mm_sub_epi32(_mm_setzero_si128(),
+                                             _mm_and_si128(hash, bit));
+        const __m128i mask_y = _mm_sub_epi32(
+            _mm_setzero_si128(), _mm_and_si128(_mm_srli_epi32(hash, 1), bit));
+        return _mm_add_epi32(
+            _mm_sub_epi32(_mm_xor_si128(dx, mask_x), mask_x),
+            _mm_sub_epi32(_mm_xor_si128(dy, mask_y), mask_y));
+    }
+
+    __attribute__((target("sse4.1")))
+    __m128i lerp_sse(__m128i a, __m128i b, __m128i t) {
+        return _mm_add_epi32(a, _mm_srai_epi32(
+            _mm_mullo_epi32(_mm_sub_epi32(b, a), t), bits));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i gradient_avx2(__m256i hash, __m256i dx, __m256i dy) {
+        hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(hash_mul));
+        hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 15));
+        const __m256i bit = _mm256_set1_epi32(1);
+        const __m256i mask_x = _mm256_sub_epi32(_mm256_setzero_si256(),
+                                                _mm256_and_si256(hash, bit));
+        const __m256i mask_y = _mm256_sub_epi32(
+            _mm256_setzero_si256(),
+            _mm256_and_si256(_mm256_srli_epi32(hash, 1), bit));
+        return _mm256_add_epi32(
+            _mm256_sub_epi32(_mm256_xor_si256(dx, mask_x), mask_x),
+            _mm256_sub_epi32(_mm256_xor_si256(dy, mask_y), mask_y));
+    }
+
+    __attribute__((target("avx2")))
+    __m256i lerp_avx2(__m256i a, __m256i b, __m256i t) {
+        return _mm256_add_epi32(a, _mm256_srai_epi32(
+            _mm256_mullo_epi32(_mm256_sub_epi32(b, a), t), bits));
+    }
+}
+
+__attribute__((target("sse4.1")))
+void FixedNoise::heights_sse(const Row &r, int y_begin, int y_end,
+                             int32_t *out) const {
+    const __m128i x0 = _mm_set1_epi32(seed ^ ((uint32_t)r.cell * prime_x));
+    const __m128i x1 = _mm_set1_epi32(
+        seed ^ ((uint32_t)(r.cell + 1) * prime_x));
+    const __m128i vone = _mm_set1_epi32(one);
+    const __m128i vtwo = _mm_set1_epi32(2 * one);
+    const __m128i dx0 = _mm_set1_epi32(r.fraction);
+    const __m128i dx1 = _mm_sub_epi32(dx0, vone);
+    const __m128i fade_x = _mm_set1_epi32(r.fade);
+    const __m128i range = _mm_set1_epi32(noise_max - noise_min);
+    const __m128i base = _mm_set1_epi32(noise_min);
+
+    int y = y_begin;
+    for (; y + 4 <= y_end; y += 4, out += 4) {
+        const __m128i y0 = _mm_loadu_si128((const __m128i*)&cell_y[y]);
+        const __m128i y1 = _mm_add_epi32(y0, _mm_set1_epi32(prime_y));
+        const __m128i dy0 = _mm_loadu_si128((const __m128i*)&fraction_y[y]);
+        const __m128i dy1 = _mm_sub_epi32(dy0, vone);
+        const __m128i a = lerp_sse(
+            gradient_sse(_mm_xor_si128(x0, y0), dx0, dy0),
+            gradient_sse(_mm_xor_si128(x1, y0), dx1, dy0), fade_x);
+        const __m128i b = lerp_sse(
+            gradient_sse(_mm_xor_si128(x0, y1), dx0, dy1),
+            gradient_sse(_mm_xor_si128(x1, y1), dx1, dy1), fade_x);
+        __m128i value = lerp_sse(
+            a, b, _mm_loadu_si128((const __m128i*)&fade_y[y]));
+        value = _mm_min_epi32(_mm_max_epi32(value, _mm_sub_epi32(
+            _mm_setzero_si128(), vtwo)), vtwo);
+        const __m128i height = _mm_add_epi32(base, _mm_srai_epi32(
+            _mm_mullo_epi32(_mm_add_epi32(value, vtwo), range), bits + 2));
+        _mm_storeu_si128((__m128i*)out, height);
+    }
+    heights_scalar(r, y, y_end, out);
+}
+
+__attribute__((target("avx2")))
+void FixedNoise::heights_avx2(const Row &r, int y_begin, int y_end,
+                              int32_t *out) const {
+    const __m256i x0 = _mm256_set1_epi32(seed ^ ((uint32_t)r.cell * prime_x));
+    const __m256i x1 = _mm256_set1_epi32(
+        seed ^ ((uint32_t)(r.cell + 1) * prime_x));
+    const __m256i vone = _mm256_set1_epi32(one);
+    const __m256i vtwo = _mm256_set1_epi32(2 * one);
+    const __m256i dx0 = _mm256_set1_epi32(r.fraction);
+    const __m256i dx1 = _mm256_sub_epi32(dx0, vone);
+    const __m256i fade_x = _mm256_set1_epi32(r.fade);
+    const __m256i range = _mm256_set1_epi32(noise_max - noise_min);
+    const __m256i base = _mm256_set1_epi32(noise_min);
+
+    int y = y_begin;
+    for (; y + 8 <= y_end; y += 8, out += 8) {
+        const __m256i y0 = _mm256_loadu_si256((const __m256i*)&cell_y[y]);
+        const __m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(prime_y));
+        const __m256i dy0 = _mm256_loadu_si256(
+            (const __m256i*)&fraction_y[y]);
+        const __m256i dy1 = _mm256_sub_epi32(dy0, vone);
+        const __m256i a = lerp_avx2(
+            gradient_avx2(_mm256_xor_si256(x0, y0), dx0, dy0),
+            gradient_avx2(_mm256_xor_si256(x1, y0), dx1, dy0), fade_x);
+        const __m256i b = lerp_avx2(
+            gradient_avx2(_mm256_xor_si256(x0, y1), dx0, dy1),
+            gradient_avx2(_mm256_xor_si256(x1, y1), dx1, dy1), fade_x);
+        __m256i value = lerp_avx2(
+            a, b, _mm256_loadu_si256((const __m256i*)&fade_y[y]));
+        value = _mm256_min_epi32(_mm256_max_epi32(value, _mm256_sub_epi32(
+            _mm256_setzero_si256(), vtwo)), vtwo);
+        const __m256i height = _mm256_add_epi32(base, _mm256_srai_epi32(
+            _mm256_mullo_epi32(_mm256_add_epi32(value, vtwo), range),
+            bits + 2));
+        _mm256_storeu_si256((__m256i*)out, height);
+    }
+    heights_scalar(r, y, y_end, out);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef FIXED_NOISE_H
+#define FIXED_NOISE_H
+
+#include <vector>
+#include <cstdint>
+
+namespace Noise {
+
+/*
+Perlin noise in fixed point: every step is integer arithmetic, so the
+result doesn't depend on the compiler, FMA contraction or the vector
+path. Cells x, y map to the noise coordinates x / period, y / period,
+the fractions are Q14, the gradients are the 4 diagonal ones.
+Rows are evaluated along y, the per-y part (lattice index, fraction and
+its fade) is computed once in the constructor.
+*/
+class FixedNoise final {
+public:
+    enum class Kernel {
+        scalar,
+        sse,
+        avx2,
+        // the best one the CPU supports
+        best
+    };
+
+    static const int fraction_bits = 14;
+    static const int32_t one = 1 << fraction_bits;
+
+    // Period 100 is the frequency 0.01 of the float noise,
+    // noise_max - noise_min has to be less than 2^15.
+    FixedNoise(int noise_min, int noise_max, int sizey,
+               int period = 100, uint32_t seed = 1337);
+
+    // Heights of cells map[x][y_begin..y_end).
+    void heights(int x, int y_begin, int y_end, int32_t *out,
+                 Kernel kernel = Kernel::best) const;
+    // Noise value in -2 * one..2 * one.
+    int32_t value(int x, int y) const;
+
+    static Kernel best_kernel();
+
+private:
+    struct Row {
+        int32_t cell;
+        int32_t fraction;
+        int32_t fade;
+    };
+    Row row(int x) const;
+
+    void heights_scalar(const Row &r, int y_begin, int y_end,
+                        int32_t *out) const;
+    void heights_sse(const Row &r, int y_begin, int y_end,
+                     int32_t *out) const;
+    void heights_avx2(const Row &r, int y_begin, int y_end,
+                      int32_t *out) const;
+
+    int noise_min;
+    int noise_max;
+    int period;
+    uint32_t seed;
+    Kernel kernel;
+    // Per y: lattice cell times the hash prime, fraction and its fade,
+    // separate arrays for the vector loads.
+    std::vector<int32_t> cell_y;
+    std::vector<int32_t> fraction_y;
+    std::vector<int32_t> fade_y;
+};
+
+}
+#endif
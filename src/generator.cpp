@@ -1,7 +1,10 @@
 #include <cstdlib>
 #include <algorithm>
 #include <cassert>
-#include <queue>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <numeric>
 #include "generator.h"
 #include "logger.h"
 #include "utils.h"
@@ -13,10 +16,11 @@ using namespace utils;
 
 void Generator::generate() {
     LOG_INFO(std::cout << "Generation process started\n";);
-    setup_map();
-    split_map();
+    init_map();
+    split_regions();
+    analyse_boundaries();
     set_properties();
-    set_height();
+    classify_boundaries();
     generate_elements();
     simulate();
 }
@@ -28,25 +32,13 @@ Map Generator::get_result() const {
 
 void Generator::setup_map() {
     LOG_INFO(std::cout << "Setting up map...\n";);
-    map.resize(sizex, std::vector<Voxel>(sizey));
-    for (int x = 0; x < sizex; x++) {
-        for (int y = 0; y < sizey; y++) {
-            Voxel &vox = map[x][y];
-            vox.color = 0;
-            vox.plate_ref = -1;
-            vox.x = x;
-            vox.y = y;
-            vox.z = 0;
-        }
-    }
+    map.assign(sizex, {});
+    fill_map(nullptr, nullptr);
     int plates_count = get_random_number_in_range(5, 15);
     plates.resize(plates_count);
 }
 
-void Generator::split_map() {
-    LOG_INFO(std::cout << "Split map into " << plates.size()
-                       << " plates...\n";);
-
+std::vector<Point> Generator::create_plates_centers() const {
     std::vector<Point> points;
     points.reserve(plates.size());
     // generate random points on plate to calcalute
@@ -54,36 +46,260 @@ void Generator::split_map() {
     // On the small map, there are might be collisions in random points,
     // but this is doesn't affect algorithms, so just ignore it.
     for(int i = 0; i < plates.size(); i++) {
-        Point p = create_random_point(0, map.size() - 1, 0, map[0].size() - 1);
+        Point p = create_random_point(0, sizex - 1, 0, sizey - 1);
         points.emplace_back(p);
         LOG_DEBUG(std::cout << "Add point to Voronoi diagram: {"
                             << p.x << ", " << p.y << "}\n";);
     }
+    return points;
+}
 
-#if 0
-    points = {
-        {3, 1}, {2, 3}, {1, 0}, {0, 1}, {1, 4}
+void Generator::init_map() {
+    // setup_map, split_map and set_height in a single pass:
+    // every voxel is written once, by the thread owning its rows.
+    int plates_count = get_random_number_in_range(5, 15);
+    plates.resize(plates_count);
+    LOG_INFO(std::cout << "Init map with " << plates.size()
+                       << " plates...\n";);
+    const std::vector<Point> points = create_plates_centers();
+    const Noise::HeightNoise noise(initial_min_height, initial_max_height,
+                                   sizex, sizey, noise_stride,
+                                   noise_fractal);
+
+    map.clear();
+    map.resize(sizex);
+    distance_fields.clear();
+    fill_map(&points, &noise);
+}
+
+void Generator::fill_map(const std::vector<Point> *points,
+                         const Noise::HeightNoise *noise) {
+    // Missing rows are allocated by the thread owning them.
+    // Plates are set if points are given, heights if noise is given,
+    // colors always follow the plates.
+    struct PlateSpan {
+        int plate;
+        PlateCells::Span span;
     };
-#endif
+    const unsigned threads = std::max(1u, std::min<unsigned>(threads_count(),
+                                                             sizex));
+    std::vector<std::vector<PlateSpan>> band_spans(threads);
+
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const int begin = (int64_t)sizex * thread_idx / threads;
+        const int end = (int64_t)sizex * (thread_idx + 1) / threads;
+        auto &spans = band_spans[thread_idx];
+        std::vector<int> candidates;
+        std::array<int, init_tile_rows> run_begin;
+        // spans of the tile rows, so they are kept ordered by x
+        std::array<std::vector<PlateSpan>, init_tile_rows> row_spans;
+        std::vector<int32_t> heights(init_tile_columns);
+
+        for (int x0 = begin; x0 < end; x0 += init_tile_rows) {
+            const int x1 = std::min(end, x0 + init_tile_rows);
+            for (int x = x0; x < x1; x++) {
+                map[x].resize(sizey, {0, 0, 0, -1, 0});
+            }
+            for (int y0 = 0; y0 < sizey; y0 += init_tile_columns) {
+                const int y1 = std::min(sizey, y0 + init_tile_columns);
+
+                // Drop the points, which are farther from the whole tile
+                // than some other point. Order of the rest is kept,
+                // so ties go to the same point, as with all of them.
+                auto tile_distance = [&](const Point &p, bool farthest) {
+                    const int dx = farthest ?
+                        std::max(std::abs(p.x - x0), std::abs(p.x - x1 + 1)) :
+                        std::max({0, x0 - p.x, p.x - x1 + 1});
+                    const int dy = farthest ?
+                        std::max(std::abs(p.y - y0), std::abs(p.y - y1 + 1)) :
+                        std::max({0, y0 - p.y, p.y - y1 + 1});
+                    return dx + dy;
+                };
+                candidates.clear();
+                if (points) {
+                    int bound = std::numeric_limits<int>::max();
+                    for (const Point &p: *points) {
+                        bound = std::min(bound, tile_distance(p, true));
+                    }
+                    const int points_cnt = points->size();
+                    for (int i = 0; i < points_cnt; i++) {
+                        if (tile_distance((*points)[i], false) <= bound) {
+                            candidates.push_back(i);
+                        }
+                    }
+                }
 
-    // Discrete voronoi diagram
-    for(int x = 0; x < sizex; x++) {
-        for(int y = 0; y < sizey; y++) {
-            int min_dist = -1;
-            int point_index = 0;
-            for (int i = 0; i < points.size(); i++) {
-                Point &p = points[i];
-                int cur_dist = std::abs(x - p.x) + std::abs(y - p.y);
-                if (min_dist < 0 || cur_dist < min_dist) {
-                    min_dist = cur_dist;
-                    point_index = i;
+                for (int x = x0; x < x1; x++) {
+                    std::vector<Voxel> &row = map[x];
+                    if (noise) {
+                        noise->heights(x, y0, y1, heights.data());
+                    }
+                    for (int y = y0; y < y1; y++) {
+                        Voxel &vox = row[y];
+                        vox.x = x;
+                        vox.y = y;
+                        if (noise) {
+                            vox.z = heights[y - y0];
+                        }
+                        if (points) {
+                            int min_dist = -1;
+                            int point_index = 0;
+                            for (const int i: candidates) {
+                                const Point &p = (*points)[i];
+                                int cur_dist = std::abs(x - p.x) +
+                                               std::abs(y - p.y);
+                                if (min_dist < 0 || cur_dist < min_dist) {
+                                    min_dist = cur_dist;
+                                    point_index = i;
+                                }
+                            }
+                            if (y == 0) {
+                                run_begin[x - x0] = 0;
+                            } else if (row[y - 1].plate_ref != point_index) {
+                                row_spans[x - x0].push_back(
+                                    {row[y - 1].plate_ref,
+                                     {x, run_begin[x - x0], y}});
+                                run_begin[x - x0] = y;
+                            }
+                            vox.plate_ref = point_index;
+                        }
+                        // Palette has only 256 colors
+                        vox.color = (vox.plate_ref + 1) % 256;
+                    }
                 }
             }
-            map[x][y].plate_ref = point_index;
+            if (!points) {
+                continue;
+            }
+            for (int x = x0; x < x1; x++) {
+                auto &row = row_spans[x - x0];
+                if (sizey > 0) {
+                    row.push_back({map[x].back().plate_ref,
+                                   {x, run_begin[x - x0], sizey}});
+                }
+                spans.insert(spans.end(), row.begin(), row.end());
+                row.clear();
+            }
+        }
+    });
+
+    if (!points) {
+        return;
+    }
+    plates_cells.assign(plates.size(), {});
+    for (const auto &spans: band_spans) {
+        for (const PlateSpan &s: spans) {
+            plates_cells[s.plate].add_span(s.span.x, s.span.y_begin,
+                                           s.span.y_end);
+        }
+    }
+}
+
+void Generator::split_map() {
+    LOG_INFO(std::cout << "Split map into " << plates.size()
+                       << " plates...\n";);
+    const std::vector<Point> points = create_plates_centers();
+    distance_fields.clear();
+    fill_map(&points, nullptr);
+}
+
+void Generator::split_regions() {
+    LOG_INFO(std::cout << "Split plates into connected regions...\n";);
+    // Voronoi cells with Manhattan distance and ties might be not
+    // connected. The first region of a plate keeps its id, the others
+    // become new plates, with the original one as a parent.
+    // Spans of split_map are the runs, no need to look at the map.
+    std::vector<PlateRegions::Run> runs;
+    std::vector<int32_t> row_pos(sizex + 1, 0);
+    for (const PlateCells &cells: plates_cells) {
+        for (const PlateCells::Span &span: cells.spans) {
+            row_pos[span.x + 1]++;
+        }
+    }
+    for (int x = 0; x < sizex; x++) {
+        row_pos[x + 1] += row_pos[x];
+    }
+    runs.resize(row_pos[sizex]);
+    const int plates_cnt = plates_cells.size();
+    for (int plate = 0; plate < plates_cnt; plate++) {
+        for (const PlateCells::Span &span: plates_cells[plate].spans) {
+            runs[row_pos[span.x]++] = {span.x, span.y_begin, span.y_end, plate};
+        }
+    }
+    // row_pos[x] is the end of row x now
+    for (int x = 0; x < sizex; x++) {
+        const int32_t begin = x > 0 ? row_pos[x - 1] : 0;
+        std::sort(runs.begin() + begin, runs.begin() + row_pos[x],
+                  [](const auto &a, const auto &b) {
+                      return a.y_begin < b.y_begin;
+                  });
+    }
+    PlateRegions regions(sizex, std::move(runs));
+
+    const size_t initial_cnt = plates.size();
+    plates_parent.resize(initial_cnt);
+    std::iota(plates_parent.begin(), plates_parent.end(), 0);
+    std::vector<bool> has_region(initial_cnt, false);
+    // plate id for every root run
+    std::vector<int> root_plate(regions.get_runs().size(), -1);
+    for (const int32_t root: regions.get_roots()) {
+        const int plate = regions.get_runs()[root].plate;
+        if (!has_region[plate]) {
+            has_region[plate] = true;
+            root_plate[root] = plate;
+            continue;
+        }
+        root_plate[root] = plates_parent.size();
+        plates_parent.push_back(plate);
+    }
+    if (plates_parent.size() == initial_cnt) {
+        return;
+    }
+    LOG_INFO(std::cout << "Found " << plates_parent.size() - initial_cnt
+                       << " disconnected plate regions\n";);
+
+    plates.resize(plates_parent.size());
+    plates_cells.assign(plates_parent.size(), {});
+    const auto &region_runs = regions.get_runs();
+    const int32_t runs_cnt = region_runs.size();
+    for (int32_t i = 0; i < runs_cnt; i++) {
+        const PlateRegions::Run &run = region_runs[i];
+        const int id = root_plate[regions.root(i)];
+        if (id != run.plate) {
+            for (int y = run.y_begin; y < run.y_end; y++) {
+                map[run.x][y].plate_ref = id;
+                map[run.x][y].color = (id + 1) % 256;
+            }
         }
+        plates_cells[id].add_span(run.x, run.y_begin, run.y_end);
     }
 }
 
+void PlateCells::add_span(int32_t x, int32_t y_begin, int32_t y_end) {
+    spans.push_back({x, y_begin, y_end});
+    cells_cnt += y_end - y_begin;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y_begin);
+    max_y = std::max(max_y, y_end - 1);
+}
+
+void Generator::analyse_boundaries() {
+    LOG_INFO(std::cout << "Analyse plate boundaries...\n";);
+    boundaries = std::make_unique<BoundaryGraph>(map);
+}
+
+const DistanceField& Generator::get_distance_field(
+        unsigned boundaries, DistanceField::Metric metric) {
+    auto &field = distance_fields[{boundaries, metric}];
+    if (!field) {
+        LOG_INFO(std::cout << "Distance transform...\n";);
+        field = std::make_unique<DistanceField>(
+            sizex, sizey, DistanceField::find_seeds(map, boundaries), metric);
+    }
+    return *field;
+}
+
 void Generator::set_properties() {
     LOG_INFO(std::cout << "Set properties...\n";);
     for (Plate& p: plates) {
@@ -93,21 +309,27 @@ void Generator::set_properties() {
     plates[0].is_edge = true;
 }
 
+void Generator::classify_boundaries() {
+    LOG_INFO(std::cout << "Classify plate boundaries...\n";);
+    boundaries_motion = boundaries->classify(plates);
+    for (auto &ids: boundaries_by_motion) {
+        ids.clear();
+    }
+    for (BoundaryGraph::VertexId v = 0; v < boundaries->vertex_cnt(); v++) {
+        boundaries_by_motion[(int)boundaries_motion[v]].push_back(v);
+    }
+    LOG_DEBUG(std::cout << "Divergent: " << boundaries_by_motion[0].size()
+                        << "\nConvergent: " << boundaries_by_motion[1].size()
+                        << "\nTransform: " << boundaries_by_motion[2].size()
+                        << '\n';);
+}
+
 void Generator::set_height() {
     LOG_INFO(std::cout << "Set heights...\n";);
-    Noise::make_noise(map, initial_min_height, initial_max_height);
-    for(int i = 0; i < sizex; i++) {
-        for(int j = 0; j < sizey; j++) {
-            Voxel &v = map[i][j];
-            // v.z = initial_height;
-            // Palette has only 256 colors
-            v.color = (v.plate_ref + 1) % 256;
-            LOG_DEBUG(std::cout << "Voxel Info:\nPos = {"
-                                << v.x << ", " << v.y << ", " << v.z << "}\n"
-                                << "Color = " << (int)v.color << '\n'
-                                << "Plate = " << v.plate_ref << '\n';);
-        }
-    }
+    const Noise::HeightNoise noise(initial_min_height, initial_max_height,
+                                   sizex, sizey, noise_stride,
+                                   noise_fractal);
+    fill_map(nullptr, &noise);
 }
 
 void generation::Generator::generate_elements() {
@@ -136,22 +358,46 @@ void generation::Generator::generate_elements() {
     if (margin_cnt < 0) {
         margin_cnt = get_random_number_in_range(0, 2);
     }
+    // Margins lift plates, which meet on a convergent boundary,
+    // any random point without such boundaries.
+    const auto &convergent = get_boundaries(BoundaryGraph::Motion::convergent);
     for (int i = 0; i < margin_cnt; i++) {
-        int x = get_random_number_in_range(0, sizex - 1);
-        int y = get_random_number_in_range(0, sizey - 1);
+        int x, y;
+        if (!convergent.empty()) {
+            const int edge =
+                get_random_number_in_range(0, convergent.size() - 1);
+            const Voxel *vox = boundaries->vertex(convergent[edge]).first;
+            x = vox->x;
+            y = vox->y;
+        } else {
+            x = get_random_number_in_range(0, sizex - 1);
+            y = get_random_number_in_range(0, sizey - 1);
+        }
         LOG_INFO(std::cout << "Add Continental Margin {"
                            << x << ", " << y << "}\n";);
-        elements.emplace_back(std::make_unique<ContinentalMargin>(map, x, y));
+        elements.emplace_back(
+            std::make_unique<ContinentalMargin>(map, plates_cells, x, y));
     }
 
     // Generate MidOceanRidge
     if (ridge_cnt < 0) {
         ridge_cnt = get_random_number_in_range(0, 1);
     }
+    // Ridges start from divergent map edges, from any map edge
+    // if there are none.
+    std::vector<BoundaryGraph::VertexId> ridge_starts;
+    for (const BoundaryGraph::VertexId v: boundaries->get_map_edges()) {
+        if (get_boundary_motion(v) == BoundaryGraph::Motion::divergent) {
+            ridge_starts.push_back(v);
+        }
+    }
+    if (ridge_starts.empty()) {
+        ridge_starts = boundaries->get_map_edges();
+    }
     for (int i = 0; i < ridge_cnt; i++) {
         LOG_INFO(std::cout << "Add MidOceanRidge\n";);
-        elements.emplace_back(
-            std::make_unique<MidOceanRidge>(map));
+        elements.emplace_back(std::make_unique<MidOceanRidge>(
+            map, *boundaries, ridge_starts, years));
     }
 
 }
@@ -167,6 +413,10 @@ void Generator::simulate() {
         for (auto &landscape: elements) {
             landscape->do_iteration(delta_years);
         }
+        const int year = current_year + delta_years;
+        if (keyframe_years > 0 && year % keyframe_years == 0) {
+            keyframe_handler(year, map);
+        }
     }
 }
 
@@ -189,14 +439,17 @@ bool LandscapeElement::point_in_map(Point p) {
 
 void LandscapeElement::do_z_shift(const Point &p, int shift) {
     if (point_in_map(p)) {
-        Voxel *v = p_voxel_from_point(map, p);
-        if (v->z + shift <= MIN_Z_SIZE || v->z + shift >= MAX_Z_SIZE) {
-            return;
-        }
-        v->z += shift;
+        do_z_shift(*p_voxel_from_point(map, p), shift);
     }
 }
 
+void LandscapeElement::do_z_shift(Voxel &v, int shift) {
+    if (v.z + shift <= MIN_Z_SIZE || v.z + shift >= MAX_Z_SIZE) {
+        return;
+    }
+    v.z += shift;
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 ///////////////// DeepSeaBasin                ////////////////////////
@@ -358,7 +611,7 @@ int DeepSeaBasin::Guyot::max_radius = 30;
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void MidOceanRidge::init() {
+void MidOceanRidge::init(int years) {
     START();
 #ifdef DEBUG
     delay_years = 0;
@@ -378,189 +631,180 @@ void MidOceanRidge::init() {
     depth_per_thousand_years = 1;
     //(plates_speed * 1000) / 100 / voxel_per_meter;
 
-    find_edges();
-    gen_graph();
+    bfs_state.resize(graph.vertex_cnt());
     create_path();
-}
 
-bool MidOceanRidge::is_vertical_edge(const Vertex &v) const {
-    return v.first->y == v.second->y;
+    // Depth at the end of the simulation, do_iteration goes by
+    // 100 years. Rays longer than the map reach no cells.
+    const int max_depth =
+        ((years + 99) / 100 * 100 / 1000) * depth_per_thousand_years;
+    const int radius = std::min<int>(max_depth + max_depth / 4,
+                                     std::max(map.size(), map[0].size()));
+    build_band(mor_path.empty() ? 0 : radius);
 }
 
-bool MidOceanRidge::is_horisontal_edge(const Vertex &v) const {
-    return v.first->x == v.second->x;
-}
+void MidOceanRidge::create_path() {
+    START()
+    // do work
+    if (!starts.empty()) {
+        const VertexId start = find_longest_path_start();
+        const VertexId end = graph.bfs(start, bfs_state);
+        try_update_path(start, end);
+    }
 
-void MidOceanRidge::find_edges() {
+    LOG_DEBUG(std::cout << "The longest path is: " << mor_path.size() << '\n';);
 
-    START()
-    std::array<int, 4> dxs = {-1, 0, 1, 0};
-    std::array<int, 4> dys = {0, -1, 0, 1};
-
-    auto add_voxels_to_edge = [this,
-                              &plates_edge=plates_edges,
-                              &map_edges=map_edges]
-                              (Voxel *a, Voxel *b) {
-        // To avoid duplicates we only emplace voxels if a is less
-        // then b, because we will get this pair two times: (a, b) and
-        // (b, a)
-        if (a->x < b->x || (a->x == b->x && a->y < b->y)) {
-            LOG_DEBUG(std::cout << "ADD pair: { "
-                                << a->x << ", " << a->y << ", " << a->plate_ref
-                                << "}, { "
-                                << b->x << ", " << b->y << ", " << b->plate_ref
-                                << "}\n";);
-            Vertex v = {a, b};
-            plates_edge.emplace_back(v);
-            if (is_horisontal_edge(v) && (a->x == 0 || b->x == map.size()-1) ||
-                is_vertical_edge(v) && (a->y == 0 || a->y == map[0].size()-1)) {
-                LOG_DEBUG(std::cout << "It is on the Map edge\n";);
-                map_edges.emplace_back(v);
-            }
-        }
-    };
+# if 0
+    // We don't need them anymore;
+    bfs_state = {};
+#endif
 
-    for (int x = 0; x < map.size(); x++) {
-        for (int y = 0; y < map[0].size(); y++) {
-            Voxel *cur = &map[x][y];
-            for (int i = 0; i < dxs.size(); i++) {
-                int dx = dxs[i];
-                int dy = dys[i];
-                Point neighbour {x + dx, y + dy};
-                if (!point_in_map(neighbour)) {
-                    continue;
-                }
-                Voxel *neighbour_v = p_voxel_from_point(map, neighbour);
-                if (cur->plate_ref != neighbour_v->plate_ref) {
-                    add_voxels_to_edge(cur, neighbour_v);
-                }
-            }
-        }
+    for (const auto& v: mor_path) {
+        auto& [v1, v2] = v;
+        v1->color = v2->color = 244;
     }
-    LOG_DEBUG(std::cout << "Edge len: " << plates_edges.size()
-                        << "\nMap edges: " << map_edges.size() << '\n';);
-}
 
-void MidOceanRidge::print_vertex(const Vertex &v) {
-    LOG_DEBUG(std::cout << "{(" << v.first->x << ", " << v.first->y << "), ("
-                        << v.second->x << ", " << v.second->y << ")}";);
 }
 
-void MidOceanRidge::gen_graph() {
+MidOceanRidge::VertexId MidOceanRidge::find_longest_path_start() {
     START()
-
-    auto insert = [&graph = graph](const Vertex &v1, const Vertex &v2) {
-        graph[v1].emplace_back(v2);
-        graph[v2].emplace_back(v1);
+    // We need the first map edge with the largest eccentricity (the longest
+    // shortest path from it), that is what BFS from every map edge gives.
+    // Eccentricity of s is bounded by BFS from any vertex u of its component:
+    //   max(d(u, s), ecc(u) - d(u, s)) <= ecc(s) <= d(u, s) + ecc(u)
+    // Starts, which upper bound is less than the best lower bound, can't be
+    // the answer, so exact values are needed only for the rest of them.
+    const std::vector<VertexId> &map_edges = starts;
+    const int32_t cnt = map_edges.size();
+    std::vector<int32_t> lower(cnt, 0);
+    std::vector<int32_t> upper(cnt, std::numeric_limits<int32_t>::max());
+    std::vector<bool> component_swept(graph.components_cnt(), false);
+    int32_t best_lower = 0;
+    int sweeps = 0;
+
+    auto set_exact = [&](int32_t i, int32_t eccentricity) {
+        lower[i] = upper[i] = eccentricity;
+        best_lower = std::max(best_lower, eccentricity);
     };
 
-    // here we will have both (a, b) and (b, a), so
-    // all conditions are single-sided to avoid duplicates in graph
-    for (const auto &e1: plates_edges) {
-        for (const auto &e2: plates_edges) {
-
-            if (e1 == e2) {
+    // Sweeps need only distances, so the parallel BFS is fine for them.
+    auto sweep = [&](VertexId source) {
+        const VertexId far = graph.parallel_bfs(source, bfs_state);
+        const std::vector<int32_t> &distance = bfs_state.distance;
+        const int32_t eccentricity = distance[far];
+        for (int32_t i = 0; i < cnt; i++) {
+            const int32_t d = distance[map_edges[i]];
+            if (d < 0) {
                 continue;
             }
+            lower[i] = std::max({lower[i], d, eccentricity - d});
+            upper[i] = std::min(upper[i], d + eccentricity);
+            best_lower = std::max(best_lower, lower[i]);
+        }
+        sweeps++;
+        return far;
+    };
 
-            const auto [e1_v1, e1_v2] = e1;
-            const auto [e2_v1, e2_v2] = e2;
+    auto unresolved = [&](int32_t i) {
+        return lower[i] != upper[i] && upper[i] >= best_lower;
+    };
 
-            if (is_vertical_edge(e1) && is_vertical_edge(e2)) {
-                if (e1_v1->x == e2_v1->x && e1_v1->y == e2_v2->y - 1) {
-                    insert(e1, e2);
-                }
+    // Double sweep in every component with map edges. The farthest vertex
+    // from the first map edge is on the periphery, and the middle of the path
+    // from there is close to the center, which gives tight upper bounds
+    // for the whole component.
+    for (int32_t i = 0; i < cnt; i++) {
+        const int32_t component = graph.component(map_edges[i]);
+        if (component_swept[component]) {
+            continue;
+        }
+        component_swept[component] = true;
+        const VertexId far = sweep(map_edges[i]);
+        bool has_unresolved = false;
+        for (int32_t j = i; j < cnt; j++) {
+            if (graph.component(map_edges[j]) == component) {
+                has_unresolved = has_unresolved || unresolved(j);
             }
+        }
+        if (!has_unresolved) {
+            continue;
+        }
 
-            if (is_horisontal_edge(e1) && is_horisontal_edge(e2)) {
-                if (e1_v1->y == e2_v1->y && e1_v1->x == e2_v2->x - 1) {
-                    insert(e1, e2);
+        const VertexId opposite = sweep(far);
+        const std::vector<int32_t> &distance = bfs_state.distance;
+        VertexId middle = opposite;
+        while (distance[middle] > distance[opposite] / 2) {
+            for (const VertexId from: graph.neighbours(middle)) {
+                if (distance[from] == distance[middle] - 1) {
+                    middle = from;
+                    break;
                 }
             }
-
-            if (is_horisontal_edge(e1) && is_vertical_edge(e2) ||
-                is_horisontal_edge(e2) && is_vertical_edge(e1)) {
-                if (e1_v1 == e2_v1 && e1_v2->x < e2_v2->x ||
-                    e1_v2 == e2_v2 && e1_v1->x < e2_v1->x ||
-                    e1_v1 == e2_v2) {
-                    insert(e1, e2);
+        }
+        sweep(middle);
+    }
+
+    // Make exact the start with the largest upper bound: it raises
+    // the best lower bound the most. When this stops pruning other
+    // starts, compute the remaining ones in parallel.
+    std::vector<int32_t> rest;
+    size_t prev_rest_size = cnt + 1;
+    while (true) {
+        rest.clear();
+        int32_t next = -1;
+        for (int32_t i = 0; i < cnt; i++) {
+            if (unresolved(i)) {
+                rest.emplace_back(i);
+                if (next < 0 || upper[i] > upper[next]) {
+                    next = i;
                 }
             }
-
         }
-    }
-
-#ifdef DEBUG
-    LOG_DEBUG(std::cout << "Graph:\n";);
-    for (const auto& v: graph) {
-        print_vertex(v.first);
-        LOG_DEBUG(std::cout << ": ");
-         for (const auto& neigh: v.second) {
-            print_vertex(neigh);
-            LOG_DEBUG(std::cout << ", ");
+        if (rest.empty()) {
+            break;
         }
-        LOG_DEBUG(std::cout << ";\n");
-    }
-#endif
-
-#if 0
-    // We don't need them anymore;
-    plates_edges.clear();
-#endif
-
-}
-
-void MidOceanRidge::create_path() {
-    START()
-    // do work
-    for (const Vertex &start: map_edges) {
-        const Vertex &end = bfs(start);
-        try_update_path(start, end);
-    }
-
-    LOG_DEBUG(std::cout << "The longest path is: " << mor_path.size() << '\n';);
-
-# if 0
-    // We don't need them anymore;
-    map_edges.clear();
-    graph.clear();
-    distance.clear();
-#endif
-
-    for (const auto& v: mor_path) {
-        auto& [v1, v2] = v;
-        v1->color = v2->color = 244;
+        if (rest.size() + 1 >= prev_rest_size) {
+            std::vector<int32_t> eccentricity(rest.size());
+            std::atomic<size_t> next_job = 0;
+            const unsigned threads = std::min<size_t>(threads_count(),
+                                                      rest.size());
+            std::vector<BfsState> states(threads);
+            run_in_parallel(threads, [&](unsigned thread_idx) {
+                BfsState &state = thread_idx ? states[thread_idx] : bfs_state;
+                state.resize(graph.vertex_cnt());
+                for (size_t job = next_job++; job < rest.size();
+                     job = next_job++) {
+                    const VertexId far = graph.bfs(map_edges[rest[job]], state);
+                    eccentricity[job] = state.distance[far];
+                }
+            });
+            for (size_t job = 0; job < rest.size(); job++) {
+                set_exact(rest[job], eccentricity[job]);
+            }
+            sweeps += rest.size();
+            break;
+        }
+        prev_rest_size = rest.size();
+        sweep(map_edges[next]);
     }
 
-}
+    LOG_DEBUG(std::cout << "BFS runs: " << sweeps << " for " << cnt
+                        << " map edges\n";);
 
-MidOceanRidge::Vertex MidOceanRidge::bfs(Vertex start) {
-    START()
-    distance.clear();
-    std::queue<Vertex> q;
-
-    q.push(start);
-    Vertex far = start;
-    distance[start] = 0;
-    while (!q.empty()) {
-        Vertex cur = q.front();
-        q.pop();
-
-        for(const Vertex& to: graph[cur]) {
-            if (!distance.contains(to)) {
-                distance[to] = distance[cur] + 1;
-                far = to;
-                q.push(to);
-            }
+    for (int32_t i = 0; i < cnt; i++) {
+        if (lower[i] == upper[i] && lower[i] == best_lower) {
+            return map_edges[i];
         }
     }
-    return far;
+    assert(false);
+    return map_edges[0];
 }
 
-void MidOceanRidge::try_update_path(Vertex start, Vertex end) {
+void MidOceanRidge::try_update_path(VertexId start, VertexId end) {
     START()
     // We have start vertex on our path which distance from itself is zero,
     // but it is still on path.
+    const std::vector<int32_t> &distance = bfs_state.distance;
     int new_distance = distance[end] + 1;
     LOG_DEBUG(std::cout << "Check path of the size " << new_distance << '\n';);
     if (new_distance <= mor_path.size()) {
@@ -570,12 +814,12 @@ void MidOceanRidge::try_update_path(Vertex start, Vertex end) {
 
     mor_path.clear();
     mor_path.resize(new_distance);
-    mor_path[--new_distance] = end;
+    mor_path[--new_distance] = graph.vertex(end);
     while (new_distance) {
 
-        for (const Vertex& from: graph[end]) {
+        for (const VertexId from: graph.neighbours(end)) {
             if (distance[from] == new_distance - 1) {
-                mor_path[--new_distance] = from;
+                mor_path[--new_distance] = graph.vertex(from);
                 end = from;
             }
         }
@@ -584,52 +828,78 @@ void MidOceanRidge::try_update_path(Vertex start, Vertex end) {
 
 }
 
-void MidOceanRidge::generation_step(int years_delta) {
-    START()
+size_t MidOceanRidge::graph_memory() const {
+    return graph.memory();
+}
 
-    int expected_depth = (gen_years / 1000) * depth_per_thousand_years;
+size_t MidOceanRidge::bfs_memory() const {
+    return bfs_state.memory();
+}
 
-    if (expected_depth <= shift_already) {
-        return;
-    }
+void MidOceanRidge::build_band(int32_t radius) {
+    START()
+    // Cast rays from both voxels of every ridge segment, perpendicular to
+    // it, one cell further at a time. The first ray, which reaches a cell,
+    // gives its distance, so every cell gets into the band once, with
+    // the distance to the nearest ridge segment.
+    const int sizey = map[0].size();
+    std::vector<bool> in_band(radius ? map.size() * sizey : 0, false);
+
+    auto add_cell = [&](Point p) {
+        if (!point_in_map(p) || in_band[p.x * sizey + p.y]) {
+            return;
+        }
+        in_band[p.x * sizey + p.y] = true;
+        band.push_back({p.x, p.y});
+    };
 
-    int diff = expected_depth - shift_already;
+    band_begin.assign(1, 0);
+    for (int32_t i = 0; i < radius; i++) {
+        for (const auto &v: mor_path) {
+            int dx = 0, dy = 0;
 
-    for(auto &v: mor_path) {
-        int dx = 0, dy = 0;
+            if (BoundaryGraph::is_horisontal_edge(v)) {
+                dy = 1;
+            } else {
+                dx = 1;
+            }
 
-        if (is_horisontal_edge(v)) {
-            dy = 1;
-        } else {
-            dx = 1;
-        }
+            auto [vox_1, vox_2] = v;
 
-        auto [vox_1, vox_2] = v;
+            add_cell({vox_1->x - i*dx, vox_1->y - i*dy});
+            add_cell({vox_2->x + i*dx, vox_2->y + i*dy});
+        }
+        band_begin.push_back(band.size());
+    }
+}
 
-        Point first {vox_1->x, vox_1->y};
-        Point second {vox_2->x, vox_2->y};
+void MidOceanRidge::generation_step(int years_delta) {
+    START()
 
-        // create deepening
-        for(int i = 0; i < expected_depth; i++) {
-            Point dfirst = first.move(-i*dx, -i*dy);
-            Point dsecond = second.move(i*dx, i*dy);
+    int expected_depth = (gen_years / 1000) * depth_per_thousand_years;
 
-            do_z_shift(dfirst, -diff);
-            do_z_shift(dsecond, -diff);
+    if (expected_depth <= shift_already) {
+        return;
+    }
 
-        }
+    int diff = expected_depth - shift_already;
 
-        // create elevation (~4 times slower, than deepening)
-        for (int i = 0; i < expected_depth / 4; i++) {
-            int dx_move = ((dx ? expected_depth:0) + i * dx);
-            int dy_move = ((dy ? expected_depth:0) + i * dy);
-            Point dfirst = first.move(-dx_move, -dy_move);
-            Point dsecond = second.move(dx_move, dy_move);
+    // Distances past the band have no cells.
+    auto band_end = [&](size_t distance) {
+        return band_begin[std::min(distance, band_begin.size() - 1)];
+    };
+    const size_t deepening_end = band_end(expected_depth);
+    const size_t elevation_end =
+        band_end(expected_depth + expected_depth / 4);
 
-            do_z_shift(dfirst, diff);
-            do_z_shift(dsecond, diff);
+    // create deepening
+    for (size_t i = 0; i < deepening_end; i++) {
+        do_z_shift(map[band[i].x][band[i].y], -diff);
+    }
 
-        }
+    // create elevation (~4 times slower, than deepening)
+    for (size_t i = deepening_end; i < elevation_end; i++) {
+        do_z_shift(map[band[i].x][band[i].y], diff);
     }
 
     shift_already = expected_depth;
@@ -671,23 +941,26 @@ void ContinentalMargin::init(int x, int y) {
     int plate_height = get_random_number_in_range(150, 250);
 
     // Lets lift this plate up
-    // And also collect edge voxels
+    // And also collect edge runs
     int plate_ref = map[x][y].plate_ref;
+    edge_x = x;
+    edge_y = y;
 
-    for (int i = 0; i < map.size(); i++) {
-        for (int j = 0; j < map[0].size(); j++) {
-
-            Voxel &v = map[i][j];
-            if (v.plate_ref != plate_ref) {
-                continue;
-            }
-
-            v.z = plate_height;
+    for (const PlateCells::Span &span: plates_cells[plate_ref].spans) {
+        const int i = span.x;
+        for (int j = span.y_begin; j < span.y_end; j++) {
+            map[i][j].z = plate_height;
+        }
 
-            if (edge_dx && i == x || edge_dy && j == y) {
-                edge.emplace_back(&v);
+        if (edge_dx && i == x) {
+            edge_runs.push_back({span.y_begin, span.y_end});
+        }
+        if (edge_dy && span.y_begin <= y && y < span.y_end) {
+            if (!edge_runs.empty() && edge_runs.back().end == i) {
+                edge_runs.back().end++;
+            } else {
+                edge_runs.push_back({i, i + 1});
             }
-
         }
     }
 
@@ -708,10 +981,27 @@ void ContinentalMargin::generation_step(int years_delta) {
 
     int diff = expected_depth - shift_already;
 
-    for (Voxel *v: edge) {
-        for (int i = 0; i < expected_depth; i++) {
-            Point p = {v->x + edge_dx * i, v->y + edge_dy * i};
-            do_z_shift(p, -diff);
+    // Sink cells closer than expected_depth to the edge,
+    // both cases go row by row.
+    if (edge_dx) {
+        const int depth = std::min<int>(expected_depth, map.size());
+        const int x_first = edge_dx > 0 ? edge_x : edge_x - depth + 1;
+        for (int x = x_first; x < x_first + depth; x++) {
+            for (const EdgeRun &run: edge_runs) {
+                for (int y = run.begin; y < run.end; y++) {
+                    do_z_shift(map[x][y], -diff);
+                }
+            }
+        }
+    } else {
+        const int depth = std::min<int>(expected_depth, map[0].size());
+        const int y_first = edge_dy > 0 ? edge_y : edge_y - depth + 1;
+        for (const EdgeRun &run: edge_runs) {
+            for (int x = run.begin; x < run.end; x++) {
+                for (int y = y_first; y < y_first + depth; y++) {
+                    do_z_shift(map[x][y], -diff);
+                }
+            }
         }
     }
 
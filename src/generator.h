@@ -4,10 +4,17 @@
 #include <vector>
 #include <memory>
 #include <utility>
+#include <functional>
 #include <map>
 #include <set>
+#include <array>
+#include <limits>
 #include "common.h"
 #include "utils.h"
+#include "boundary_graph.h"
+#include "distance_field.h"
+#include "plate_regions.h"
+#include "noise.h"
 
 namespace generation {
 
@@ -39,6 +46,7 @@ protected:
 
     bool point_in_map(Point p);
     void do_z_shift(const Point &p, int shift);
+    void do_z_shift(Voxel &v, int shift);
 
 
     Map &map;
@@ -49,27 +57,110 @@ protected:
     int shift_already = 0;
 };
 
+// Cells of one plate, built by split_map as a by-product.
+// Per-plate passes walk the spans instead of the whole map.
+struct PlateCells final {
+    // Run of the plate cells map[x][y_begin..y_end).
+    struct Span {
+        int32_t x;
+        int32_t y_begin;
+        int32_t y_end;
+    };
+
+    // Bounding box, inclusive. Empty plate has min > max.
+    int32_t min_x = std::numeric_limits<int32_t>::max();
+    int32_t min_y = std::numeric_limits<int32_t>::max();
+    int32_t max_x = -1;
+    int32_t max_y = -1;
+    size_t cells_cnt = 0;
+    // Ordered by x, then by y, same as the map traversal.
+    std::vector<Span> spans;
+
+    void add_span(int32_t x, int32_t y_begin, int32_t y_end);
+};
+
 class Generator final {
 public:
 
     Generator(const GenParams &params):
         sizex(params.sizex), sizey(params.sizey), years(params.years),
         ridge_cnt(params.mor_cnt), basin_cnt(params.basin_cnt),
-        margin_cnt(params.margin_cnt) {}
+        margin_cnt(params.margin_cnt), noise_stride(params.noise_stride),
+        noise_fractal{params.noise_type, params.noise_octaves,
+                      params.noise_gain, params.noise_lacunarity,
+                      params.noise_slope, params.noise_seed} {
+        if (params.seed >= 0) {
+            utils::set_random_seed(params.seed);
+        }
+    }
     void generate();
     Map get_result() const;
+    const std::vector<PlateCells>& get_plates_cells() const {
+        return plates_cells;
+    }
+    // Plate, which was split into the given one by split_regions.
+    const std::vector<int>& get_plates_parent() const {
+        return plates_parent;
+    }
+    // Boundary edges with the given motion of the plates,
+    // filled by classify_boundaries.
+    const std::vector<BoundaryGraph::VertexId>& get_boundaries(
+            BoundaryGraph::Motion motion) const {
+        return boundaries_by_motion[(int)motion];
+    }
+    BoundaryGraph::Motion get_boundary_motion(
+            BoundaryGraph::VertexId v) const {
+        return boundaries_motion[v];
+    }
+    // Distance to the selected DistanceField::Boundary set,
+    // computed on the first request and cached until the next split_map.
+    const DistanceField& get_distance_field(unsigned boundaries,
+                                            DistanceField::Metric metric);
 
+    // The same as setup_map, split_map and set_height together.
+    void init_map();
     void setup_map();
     void split_map();
+    void split_regions();
+    void analyse_boundaries();
     void set_properties();
+    void classify_boundaries();
     void generate_elements();
     void set_height();
     void simulate();
 
+    // handler(year, map) is called by simulate every every_years years,
+    // 0 switches the keyframes off.
+    void set_keyframes(int every_years,
+                       std::function<void(int, const Map&)> handler) {
+        keyframe_years = every_years;
+        keyframe_handler = std::move(handler);
+    }
+
 private:
 
+    std::vector<Point> create_plates_centers() const;
+    // Pass over the map by tiles, shared by init_map and the stages.
+    // The nearest of points is the plate of a voxel, noise gives
+    // its height, either may be null, then the voxels keep them.
+    void fill_map(const std::vector<Point> *points,
+                  const Noise::HeightNoise *noise);
+
+    // Tile of fill_map, nearest plate centers are found per tile.
+    static const int init_tile_rows = 16;
+    static const int init_tile_columns = 256;
+
     Map map;
     std::vector<Plate> plates;
+    std::vector<PlateCells> plates_cells;
+    std::vector<int> plates_parent;
+    // Built after split_map, shared by all the elements.
+    std::unique_ptr<BoundaryGraph> boundaries;
+    std::vector<BoundaryGraph::Motion> boundaries_motion;
+    std::array<std::vector<BoundaryGraph::VertexId>,
+               BoundaryGraph::motions_cnt> boundaries_by_motion;
+    std::map<std::pair<unsigned, DistanceField::Metric>,
+             std::unique_ptr<DistanceField>> distance_fields;
     std::vector<std::unique_ptr<LandscapeElement>> elements;
     int sizex;
     int sizey;
@@ -77,7 +168,12 @@ private:
     int ridge_cnt;
     int basin_cnt;
     int margin_cnt;
+    // Step of the lattice the initial noise is evaluated on.
+    int noise_stride;
+    Noise::Fractal noise_fractal;
     int initial_height = 100;
+    int keyframe_years = 0;
+    std::function<void(int, const Map&)> keyframe_handler;
 };
 
 class DeepSeaBasin final: public LandscapeElement {
@@ -137,41 +233,58 @@ private:
 
 class MidOceanRidge final: public LandscapeElement {
 public:
-    MidOceanRidge(Map &map): LandscapeElement(map) {
-        init();
+    // The ridge is the longest boundary path from one of the starts,
+    // map edges of the graph. The band is built for a simulation of years.
+    MidOceanRidge(Map &map, const BoundaryGraph &graph,
+                  std::vector<BoundaryGraph::VertexId> starts, int years):
+        LandscapeElement(map), graph(graph), starts(std::move(starts)) {
+        init(years);
     }
 
     void generation_step(int years_delta) override;
 
+    // Memory held by the boundary graph and by the BFS work buffers,
+    // in bytes.
+    size_t graph_memory() const;
+    size_t bfs_memory() const;
+
 private:
 
-    using Vertex = std::pair<Voxel*, Voxel*>;
-    void print_vertex(const Vertex &v);
-    void init();
-    void find_edges();
-    void gen_graph();
+    using Vertex = BoundaryGraph::Vertex;
+    using VertexId = BoundaryGraph::VertexId;
+    using BfsState = BoundaryGraph::BfsState;
+
+    void init(int years);
     void create_path();
 
-    Vertex bfs(Vertex start);
-    void try_update_path(Vertex start, Vertex end);
+    VertexId find_longest_path_start();
+    void try_update_path(VertexId start, VertexId end);
+    void build_band(int32_t radius);
 
-    bool is_vertical_edge(const Vertex &v) const;
-    bool is_horisontal_edge(const Vertex &v) const;
+    // Cell near the ridge.
+    struct BandCell {
+        int32_t x;
+        int32_t y;
+    };
 
-    // we gonna look for the longest path between these vertices
-    std::vector<Vertex> map_edges;
-    std::vector<Vertex> plates_edges;
-    // TODO: create hash for Vertex and use unordered_set
-    std::map<Vertex, std::vector<Vertex>> graph;
-    std::map<Vertex, int> distance;
+    const BoundaryGraph &graph;
+    std::vector<VertexId> starts;
+    BfsState bfs_state;
     std::vector<Vertex> mor_path;
+    // Cells ordered by the distance to the nearest ridge segment, counted
+    // along the ray perpendicular to it, the cell next to the ridge has
+    // distance 1. band_begin[d] is the first cell with distance > d.
+    std::vector<BandCell> band;
+    std::vector<size_t> band_begin;
     int depth_per_thousand_years = 0;
 };
 
 class ContinentalMargin final: public LandscapeElement {
 
 public:
-    ContinentalMargin(Map &map, int x, int y): LandscapeElement(map) {
+    ContinentalMargin(Map &map, const std::vector<PlateCells> &plates_cells,
+                      int x, int y):
+        LandscapeElement(map), plates_cells(plates_cells) {
         init(x, y);
     }
 
@@ -181,7 +294,19 @@ private:
 
     void init(int x, int y);
 
-    std::vector<Voxel*> edge;
+    // Run of the plate cells along the map edge, [begin, end) in y
+    // for the edge at x = edge_x, in x for the edge at y = edge_y.
+    struct EdgeRun {
+        int32_t begin;
+        int32_t end;
+    };
+
+    const std::vector<PlateCells> &plates_cells;
+    // Distance from the edge is |x - edge_x| or |y - edge_y|, so the band
+    // of sinking cells is a rectangle for every run.
+    std::vector<EdgeRun> edge_runs;
+    int edge_x = 0;
+    int edge_y = 0;
     int edge_dx = 0;
     int edge_dy = 0;
     int depth_per_thousand_years = 0;
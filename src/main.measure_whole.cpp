@@ -19,6 +19,18 @@ namespace {
     const std::string_view MID_OCEAN_RIDGE_CNT = "--mor-cnt=";
     const std::string_view DEEP_SEA_BASIN_CNT = "--basin-cnt=";
     const std::string_view CONTINENTAL_MARGIN_CNT = "--margin-cnt=";
+    const std::string_view SEED = "--seed=";
+    const std::string_view NOISE_STRIDE = "--noise-stride=";
+    const std::string_view NOISE = "--noise=";
+    const std::string_view OCTAVES = "--octaves=";
+    const std::string_view GAIN = "--gain=";
+    const std::string_view LACUNARITY = "--lacunarity=";
+    const std::string_view SLOPE = "--slope=";
+    const std::string_view EXPORT = "--export=";
+    const std::string_view KEYFRAME_YEARS = "--keyframe-years=";
+    const std::string_view SHARD_SIZE = "--shard-size=";
+    const std::string_view EXPORT_LOD = "--export-lod=";
+    const std::string_view LOD_FILTER = "--lod-filter=";
 
 }
 
@@ -32,6 +44,12 @@ std::optional<GenParams> parse_input(std::vector<std::string_view> input) {
         return res.ec != std::errc::invalid_argument &&
                res.ec != std::errc::result_out_of_range;
     };
+    auto str2float = [](std::string_view full, std::string_view extra, float &out) {
+        auto float_part = full.substr(extra.size());
+        auto res = std::from_chars(float_part.begin(), float_part.end(), out);
+        return res.ec != std::errc::invalid_argument &&
+               res.ec != std::errc::result_out_of_range;
+    };
 
     for (const auto param: input) {
         if(param.starts_with(SIZEX)) {
@@ -58,6 +76,60 @@ std::optional<GenParams> parse_input(std::vector<std::string_view> input) {
             if(!str2int(param, CONTINENTAL_MARGIN_CNT, res.margin_cnt)) return {};
             years = true;
         }
+        if(param.starts_with(SEED)) {
+            if(!str2int(param, SEED, res.seed)) return {};
+        }
+        if(param.starts_with(NOISE_STRIDE)) {
+            if(!str2int(param, NOISE_STRIDE, res.noise_stride)) return {};
+            if(res.noise_stride < 1) return {};
+        }
+        if(param.starts_with(NOISE)) {
+            auto type = param.substr(NOISE.size());
+            if(type == "perlin") res.noise_type = NoiseType::perlin;
+            else if(type == "fbm") res.noise_type = NoiseType::fbm;
+            else if(type == "ridged") res.noise_type = NoiseType::ridged;
+            else if(type == "fixed") res.noise_type = NoiseType::fixed;
+            else if(type == "spectral") res.noise_type = NoiseType::spectral;
+            else return {};
+        }
+        if(param.starts_with(OCTAVES)) {
+            if(!str2int(param, OCTAVES, res.noise_octaves)) return {};
+            if(res.noise_octaves < 1) return {};
+        }
+        if(param.starts_with(GAIN)) {
+            if(!str2float(param, GAIN, res.noise_gain)) return {};
+        }
+        if(param.starts_with(LACUNARITY)) {
+            if(!str2float(param, LACUNARITY, res.noise_lacunarity)) return {};
+        }
+        if(param.starts_with(SLOPE)) {
+            if(!str2float(param, SLOPE, res.noise_slope)) return {};
+        }
+        if(param.starts_with(EXPORT)) {
+            auto mode = param.substr(EXPORT.size());
+            if(mode == "solid") res.export_mode = ExportMode::solid;
+            else if(mode == "shell") res.export_mode = ExportMode::shell;
+            else return {};
+        }
+        if(param.starts_with(KEYFRAME_YEARS)) {
+            if(!str2int(param, KEYFRAME_YEARS, res.keyframe_years)) return {};
+            if(res.keyframe_years < 0) return {};
+        }
+        if(param.starts_with(SHARD_SIZE)) {
+            if(!str2int(param, SHARD_SIZE, res.shard_size)) return {};
+            if(res.shard_size < 0) return {};
+        }
+        if(param.starts_with(EXPORT_LOD)) {
+            if(!str2int(param, EXPORT_LOD, res.export_lod)) return {};
+            if(res.export_lod < 0 || res.export_lod > 16) return {};
+        }
+        if(param.starts_with(LOD_FILTER)) {
+            auto filter = param.substr(LOD_FILTER.size());
+            if(filter == "mean") res.lod_filter = LodFilter::mean;
+            else if(filter == "max") res.lod_filter = LodFilter::max;
+            else if(filter == "min") res.lod_filter = LodFilter::min;
+            else return {};
+        }
         if(param.starts_with(OUTPUT)) {
             res.file = param.substr(OUTPUT.size());
         }
@@ -80,7 +152,19 @@ int main(int argc, char **argv) {
                   << "[ " << OUTPUT << "file ] "
                   << "[ " << MID_OCEAN_RIDGE_CNT << "cnt ] "
                   << "[ " << DEEP_SEA_BASIN_CNT << "cnt ] "
-                  << "[ " << CONTINENTAL_MARGIN_CNT << "cnt ]\n";
+                  << "[ " << CONTINENTAL_MARGIN_CNT << "cnt ] "
+                  << "[ " << SEED << "N ] "
+                  << "[ " << NOISE_STRIDE << "N ] "
+                  << "[ " << NOISE << "perlin|fbm|ridged|fixed|spectral ] "
+                  << "[ " << OCTAVES << "N ] "
+                  << "[ " << GAIN << "F ] "
+                  << "[ " << LACUNARITY << "F ] "
+                  << "[ " << SLOPE << "F ] "
+                  << "[ " << EXPORT << "solid|shell ] "
+                  << "[ " << KEYFRAME_YEARS << "N ] "
+                  << "[ " << SHARD_SIZE << "N ] "
+                  << "[ " << EXPORT_LOD << "k ] "
+                  << "[ " << LOD_FILTER << "mean|max|min ]\n";
 
         return 0;
     }
@@ -42,4 +42,13 @@ void do_bench(
 
 }
 
+void print_memory(
+    const std::string_view result_file,
+    const std::vector<std::pair<std::string_view, size_t>>& sizes) {
+    std::ofstream outf(result_file.data());
+    for (auto &[name, size]: sizes) {
+        outf << name << ' ' << size << '\n';
+    }
+}
+
 }
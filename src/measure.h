@@ -6,6 +6,7 @@
 #include <string_view>
 #include <functional>
 #include <fstream>
+#include <utility>
 #include "logger.h"
 
 namespace measure {
@@ -45,6 +46,11 @@ void do_bench(
     std::function<void()> f,
     int repeats = 1000);
 
+// Write sizes in bytes, one "name size" pair per line.
+void print_memory(
+    const std::string_view result_file,
+    const std::vector<std::pair<std::string_view, size_t>>& sizes);
+
 } // namespace measure
 
 #endif
@@ -5,9 +5,11 @@
 #include <cmath>
 #include <algorithm>
 #include <random>
-#include "noise/FastNoiseLite.h"
+#include <memory>
+#include <mutex>
 #include "noise.h"
 #include "logger.h"
+#include "utils.h"
 
 /*
 namespace {
@@ -128,23 +130,302 @@ void make_noise(Map& map, int noise_min, int noise_max) {
 }
 */
 
-void make_noise(Map& map, int noise_min, int noise_max) {
-    LOG_DEBUG(std::cout << "Start making noise\n";);
-    LOG_DEBUG(std::cout << noise_min << ' ' << noise_max << '\n';);
-    FastNoiseLite noise;
+namespace {
+    // FastNoiseLite default, HeightNoise doesn't change it.
+    const float noise_frequency = 0.01f;
+
+    // Octave of the fractal noise in the lattice nodes.
+    struct OctaveKey {
+        int seed;
+        float frequency;
+        // 0 for the first octave, it doesn't depend on lacunarity
+        float lacunarity;
+        int octave;
+        int stride;
+        int border;
+        int nodes_x;
+        int nodes_y;
+
+        bool operator==(const OctaveKey &other) const = default;
+    };
+
+    struct CachedOctave {
+        OctaveKey key;
+        std::shared_ptr<const std::vector<float>> values;
+        uint64_t last_use;
+    };
+
+    std::mutex octave_cache_mutex;
+    std::vector<CachedOctave> octave_cache;
+    uint64_t octave_cache_clock = 0;
+    size_t octave_cache_limit = 0;
+
+    size_t octave_bytes(const CachedOctave &octave) {
+        return octave.values->size() * sizeof(float);
+    }
+
+    void shrink_octave_cache(size_t limit) {
+        size_t total = 0;
+        for (const CachedOctave &octave: octave_cache) {
+            total += octave_bytes(octave);
+        }
+        while (total > limit) {
+            auto oldest = std::min_element(
+                octave_cache.begin(), octave_cache.end(),
+                [](const auto &a, const auto &b) {
+                    return a.last_use < b.last_use;
+                });
+            total -= octave_bytes(*oldest);
+            octave_cache.erase(oldest);
+        }
+    }
+
+    std::shared_ptr<const std::vector<float>> find_octave(
+            const OctaveKey &key) {
+        std::lock_guard lock(octave_cache_mutex);
+        for (CachedOctave &octave: octave_cache) {
+            if (octave.key == key) {
+                octave.last_use = ++octave_cache_clock;
+                return octave.values;
+            }
+        }
+        return nullptr;
+    }
+
+    void store_octave(const OctaveKey &key,
+                      std::shared_ptr<const std::vector<float>> values) {
+        std::lock_guard lock(octave_cache_mutex);
+        octave_cache.push_back({key, std::move(values), ++octave_cache_clock});
+        shrink_octave_cache(octave_cache_limit);
+    }
+
+    // The same coordinates and seeds, as FastNoiseLite fractal noise uses,
+    // so the sum of octaves is equal to its GetNoise. GetNoise is scalar,
+    // only the sums of the octaves are vectorized.
+    std::shared_ptr<const std::vector<float>> octave_values(
+            const OctaveKey &key, float lacunarity) {
+        if (auto cached = find_octave(key)) {
+            return cached;
+        }
+        FastNoiseLite noise;
+        noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
+        noise.SetFrequency(1.0f);
+        noise.SetSeed(key.seed + key.octave);
+        auto values = std::make_shared<std::vector<float>>(
+            (size_t)key.nodes_x * key.nodes_y);
+
+        const unsigned threads = utils::threads_count();
+        utils::run_in_parallel(threads, [&](unsigned thread_idx) {
+            std::vector<float> ys(key.nodes_y);
+            for (int j = 0; j < key.nodes_y; j++) {
+                ys[j] = (float)((j - key.border) * key.stride) * key.frequency;
+                for (int i = 0; i < key.octave; i++) {
+                    ys[j] *= lacunarity;
+                }
+            }
+            for (int i = thread_idx; i < key.nodes_x; i += threads) {
+                float x = (float)((i - key.border) * key.stride) * key.frequency;
+                for (int k = 0; k < key.octave; k++) {
+                    x *= lacunarity;
+                }
+                float *row = values->data() + (size_t)i * key.nodes_y;
+                for (int j = 0; j < key.nodes_y; j++) {
+                    row[j] = noise.GetNoise(x, ys[j]);
+                }
+            }
+        });
+        store_octave(key, values);
+        return values;
+    }
+}
+
+void set_octave_cache_limit(size_t bytes) {
+    std::lock_guard lock(octave_cache_mutex);
+    octave_cache_limit = bytes;
+    shrink_octave_cache(octave_cache_limit);
+}
+
+size_t octave_cache_memory() {
+    std::lock_guard lock(octave_cache_mutex);
+    size_t total = 0;
+    for (const CachedOctave &octave: octave_cache) {
+        total += octave_bytes(octave);
+    }
+    return total;
+}
+
+HeightNoise::HeightNoise(int noise_min, int noise_max,
+                         int sizex, int sizey, int stride,
+                         const Fractal &fractal):
+    noise_min(noise_min), noise_max(noise_max), stride(std::max(1, stride)),
+    is_fractal(fractal.type == NoiseType::fbm ||
+               fractal.type == NoiseType::ridged) {
     noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-    int w = map.size();
-    int h = map[0].size();
-    for(int i = 0; i < w; i++) {
-        for (int j = 0; j < h; j++) {
-            float noise_res = warp(noise.GetNoise((float)i, (float)j)); // -1..1
-            noise_res += 1; noise_res /= 2; // 0..1
-            map[i][j].z = std::lerp(noise_min, noise_max, noise_res);
-            LOG_DEBUG(std::cout << noise_res << " (" << map[i][j].z << ") ";);
+    noise.SetSeed(fractal.seed);
+    if (fractal.type == NoiseType::fixed) {
+        fixed.emplace(noise_min, noise_max, sizey,
+                      std::lround(1 / noise_frequency), fractal.seed);
+        return;
+    }
+    if (fractal.type == NoiseType::spectral) {
+        spectral.emplace(noise_min, noise_max, sizex, sizey, fractal.slope,
+                         fractal.seed);
+        return;
+    }
+    if (this->stride == 1 && !is_fractal) {
+        return;
+    }
+    stride = this->stride;
+
+    for (int offset = 0; offset < stride; offset++) {
+        const float t = (float)offset / stride;
+        const float t2 = t * t;
+        const float t3 = t2 * t;
+        weights[0].push_back(0.5f * (-t3 + 2 * t2 - t));
+        weights[1].push_back(0.5f * (3 * t3 - 5 * t2 + 2));
+        weights[2].push_back(0.5f * (-3 * t3 + 4 * t2 + t));
+        weights[3].push_back(0.5f * (t3 - t2));
+    }
+
+    border = stride > 1 ? 1 : 0;
+    const int lattice_sizex = stride > 1 ? (sizex - 1) / stride + 4 : sizex;
+    lattice_sizey = stride > 1 ? (sizey - 1) / stride + 4 : sizey;
+    if (is_fractal) {
+        fractal_nodes(fractal, lattice_sizex);
+        return;
+    }
+
+    lattice.resize((size_t)lattice_sizex * lattice_sizey);
+    const unsigned threads = utils::threads_count();
+    utils::run_in_parallel(threads, [&](unsigned thread_idx) {
+        for (int i = thread_idx; i < lattice_sizex; i += threads) {
+            for (int j = 0; j < lattice_sizey; j++) {
+                lattice[(size_t)i * lattice_sizey + j] =
+                    exact((i - border) * stride, (j - border) * stride);
+            }
+        }
+    });
+}
+
+void HeightNoise::fractal_nodes(const Fractal &fractal, int nodes_x) {
+    START()
+    // Sum of octaves, the same as FastNoiseLite GenFractalFBm and
+    // GenFractalRidged with zero weighted strength.
+    float amp_fractal = 1.0f;
+    float amp = std::abs(fractal.gain);
+    for (int i = 1; i < fractal.octaves; i++) {
+        amp_fractal += amp;
+        amp *= std::abs(fractal.gain);
+    }
+
+    const size_t nodes_cnt = (size_t)nodes_x * lattice_sizey;
+    lattice.assign(nodes_cnt, 0.0f);
+    amp = 1 / amp_fractal;
+    for (int octave = 0; octave < fractal.octaves; octave++) {
+        const OctaveKey key {
+            fractal.seed, noise_frequency,
+            octave > 0 ? fractal.lacunarity : 0.0f, octave,
+            stride, border, nodes_x, lattice_sizey
+        };
+        const auto values = octave_values(key, fractal.lacunarity);
+        const float *v = values->data();
+        float *sum = lattice.data();
+        if (fractal.type == NoiseType::ridged) {
+            for (size_t i = 0; i < nodes_cnt; i++) {
+                sum[i] += (std::abs(v[i]) * -2 + 1) * amp;
+            }
+        } else {
+            for (size_t i = 0; i < nodes_cnt; i++) {
+                sum[i] += v[i] * amp;
+            }
         }
-        LOG_DEBUG(std::cout << '\n';);
+        amp *= fractal.gain;
     }
 }
 
+float HeightNoise::exact(int x, int y) const {
+    return noise.GetNoise((float)x, (float)y);
+}
+
+int32_t HeightNoise::to_height(float noise_res) const {
+    noise_res = warp(noise_res); // -1..1
+    noise_res += 1; noise_res /= 2; // 0..1
+    return std::lerp(noise_min, noise_max, noise_res);
+}
+
+int32_t HeightNoise::height(int x, int y) const {
+    if (fixed) {
+        int32_t res;
+        fixed->heights(x, y, y + 1, &res);
+        return res;
+    }
+    if (spectral) {
+        return spectral->height(x, y);
+    }
+    if (stride == 1) {
+        return to_height(is_fractal ?
+            lattice[(size_t)x * lattice_sizey + y] : exact(x, y));
+    }
+    int32_t res;
+    heights(x, y, y + 1, &res);
+    return res;
+}
+
+void HeightNoise::heights(int x, int y_begin, int y_end, int32_t *out) const {
+    if (fixed) {
+        fixed->heights(x, y_begin, y_end, out);
+        return;
+    }
+    if (spectral) {
+        spectral->heights(x, y_begin, y_end, out);
+        return;
+    }
+    if (stride == 1) {
+        for (int y = y_begin; y < y_end; y++) {
+            *out++ = height(x, y);
+        }
+        return;
+    }
+
+    // Interpolate along x first: a row of columns between the lattice
+    // rows around x, then every cell is a 4 point interpolation along y.
+    const float *rows[4];
+    const int offset_x = x % stride;
+    for (int k = 0; k < 4; k++) {
+        rows[k] = lattice.data() + (size_t)(x / stride + k) * lattice_sizey;
+    }
+    const float wx[4] = {weights[0][offset_x], weights[1][offset_x],
+                         weights[2][offset_x], weights[3][offset_x]};
+
+    const int j_begin = y_begin / stride;
+    const int j_end = (y_end - 1) / stride + 4;
+    std::vector<float> columns(j_end - j_begin);
+    for (int j = j_begin; j < j_end; j++) {
+        columns[j - j_begin] = wx[0] * rows[0][j] + wx[1] * rows[1][j] +
+                               wx[2] * rows[2][j] + wx[3] * rows[3][j];
+    }
+
+    std::vector<float> values(y_end - y_begin);
+    for (int y = y_begin; y < y_end;) {
+        const int j = y / stride;
+        const float *c = columns.data() + (j - j_begin);
+        const int offset_begin = y - j * stride;
+        const int offset_end = std::min(stride, y_end - j * stride);
+        float *v = values.data() + (j * stride - y_begin);
+        for (int offset = offset_begin; offset < offset_end; offset++) {
+            v[offset] = weights[0][offset] * c[0] + weights[1][offset] * c[1] +
+                        weights[2][offset] * c[2] + weights[3][offset] * c[3];
+        }
+        y = j * stride + offset_end;
+    }
+
+    // The same as to_height, without branches of std::lerp,
+    // so the loop is vectorized.
+    const float half_range = (noise_max - noise_min) / 2.0f;
+    for (int i = 0; i < y_end - y_begin; i++) {
+        const float noise_res = std::clamp(values[i], -1.0f, 1.0f);
+        out[i] = noise_min + (noise_res + 1) * half_range;
+    }
+}
 
 }
@@ -1,11 +1,73 @@
 #ifndef NOISE_H
 #define NOISE_H
 
+#include <array>
+#include <vector>
+#include <cstddef>
 #include "common.h"
+#include <optional>
+#include "noise/FastNoiseLite.h"
+#include "fixed_noise.h"
+#include "spectral_noise.h"
 
 namespace Noise {
 
-void make_noise(Map& map, int noise_min, int noise_max);
+// Octaves of fbm and ridged noise, as FastNoiseLite fractal settings.
+// Fixed noise is a single octave, evaluated in every cell.
+// Spectral noise uses only the slope of its spectrum.
+struct Fractal {
+    NoiseType type = NoiseType::perlin;
+    int octaves = 3;
+    float gain = 0.5f;
+    float lacunarity = 2.0f;
+    float slope = 2.0f;
+    // FastNoiseLite seed, for all the noise types.
+    int seed = 1337;
+};
+
+// Single octaves of the fractal noise are kept between HeightNoise
+// instances, so runs with other gain or lacunarity reuse them.
+// Least recently used octaves are dropped over the limit. The limit is 0,
+// nothing is kept, until a parameter sweep sets it.
+void set_octave_cache_limit(size_t bytes);
+size_t octave_cache_memory();
+
+// Heights of the map cells. Const, so it can be shared by threads.
+// With stride > 1 the noise is evaluated only on the lattice with this
+// step, the other cells are bicubic (Catmull-Rom) interpolation of it.
+// Fractal noise is evaluated in the constructor, octave by octave,
+// for all the lattice nodes (every cell with stride 1).
+class HeightNoise final {
+public:
+    HeightNoise(int noise_min, int noise_max,
+                int sizex, int sizey, int stride = 1,
+                const Fractal &fractal = {});
+
+    int32_t height(int x, int y) const;
+    // Heights of cells map[x][y_begin..y_end).
+    void heights(int x, int y_begin, int y_end, int32_t *out) const;
+
+private:
+    float exact(int x, int y) const;
+    int32_t to_height(float noise) const;
+    void fractal_nodes(const Fractal &fractal, int nodes_x);
+
+    FastNoiseLite noise;
+    int noise_min;
+    int noise_max;
+    int stride;
+    bool is_fractal;
+    // Values in lattice nodes (i - border) * stride, (j - border) * stride.
+    // With stride > 1 there is one more node before the map and two
+    // after it, with stride 1 nodes are the cells.
+    int border = 0;
+    int lattice_sizey = 0;
+    std::vector<float> lattice;
+    // Catmull-Rom weights for the offset from the node, weights[k][offset].
+    std::array<std::vector<float>, 4> weights;
+    std::optional<FixedNoise> fixed;
+    std::optional<SpectralNoise> spectral;
+};
 
 }
 #endif
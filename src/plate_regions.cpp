@@ -0,0 +1,109 @@
+#include <algorithm>
+#include "plate_regions.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace generation;
+using namespace utils;
+
+// A run is united in 10-20 ns, a thread starts in 10-20 us: a band pays
+// for its thread from about 2k runs. A 5000 x 5000 map has ~15k runs.
+size_t PlateRegions::band_runs_min = 2048;
+
+PlateRegions::PlateRegions(int sizex, std::vector<Run> map_runs):
+    runs(std::move(map_runs)) {
+    START()
+    const int32_t runs_cnt = runs.size();
+    row_begin.assign(sizex + 1, 0);
+    for (const Run &run: runs) {
+        row_begin[run.x + 1]++;
+    }
+    for (int x = 0; x < sizex; x++) {
+        row_begin[x + 1] += row_begin[x];
+    }
+    parent.resize(runs_cnt);
+
+    const unsigned threads = std::max<size_t>(1, std::min<size_t>({
+        threads_count(), (size_t)sizex, runs.size() / band_runs_min}));
+    auto band_begin = [&](unsigned thread_idx) {
+        return (int)((int64_t)sizex * thread_idx / threads);
+    };
+
+    std::vector<std::vector<int32_t>> band_roots(threads);
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const int begin = band_begin(thread_idx);
+        const int end = band_begin(thread_idx + 1);
+        for (int32_t i = row_begin[begin]; i < row_begin[end]; i++) {
+            parent[i] = i;
+        }
+        for (int x = begin + 1; x < end; x++) {
+            unite_rows(x);
+        }
+    });
+
+    // Merge the bands, only the border rows are touched.
+    for (unsigned thread_idx = 1; thread_idx < threads; thread_idx++) {
+        unite_rows(band_begin(thread_idx));
+    }
+
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const int32_t begin = row_begin[band_begin(thread_idx)];
+        const int32_t end = row_begin[band_begin(thread_idx + 1)];
+        for (int32_t i = begin; i < end; i++) {
+            if (parent[i] == i) {
+                band_roots[thread_idx].push_back(i);
+            }
+        }
+    });
+    for (const auto &found: band_roots) {
+        roots.insert(roots.end(), found.begin(), found.end());
+    }
+    LOG_DEBUG(std::cout << "Runs: " << runs_cnt
+                        << "\nRegions: " << roots.size() << '\n';);
+}
+
+int32_t PlateRegions::root(int32_t run) const {
+    while (parent[run] != run) {
+        run = parent[run];
+    }
+    return run;
+}
+
+int32_t PlateRegions::find_compress(int32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void PlateRegions::unite(int32_t a, int32_t b) {
+    a = find_compress(a);
+    b = find_compress(b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+void PlateRegions::unite_rows(int x) {
+    int32_t up = row_begin[x - 1];
+    const int32_t up_end = row_begin[x];
+    int32_t cur = row_begin[x];
+    const int32_t cur_end = row_begin[x + 1];
+    // Both rows are sorted by y, walk them together.
+    while (up < up_end && cur < cur_end) {
+        const Run &a = runs[up];
+        const Run &b = runs[cur];
+        if (a.plate == b.plate &&
+            a.y_begin < b.y_end && b.y_begin < a.y_end) {
+            unite(up, cur);
+        }
+        if (a.y_end < b.y_end) {
+            up++;
+        } else {
+            cur++;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PLATE_REGIONS_H
+#define PLATE_REGIONS_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace generation {
+
+/*
+Connected regions of the same plate, 4-neighbourhood.
+Works on runs of the same plate in the map rows, not on cells: two runs
+in the neighbour rows are connected, if they overlap and have the same
+plate. Union-find over the run indices, the smaller index wins, so the
+root of a region is its first run in the map order.
+Rows are split into bands, every thread unites runs of its own band,
+then the bands are merged along their borders.
+*/
+class PlateRegions final {
+public:
+    // Cells map[x][y_begin..y_end) of the plate.
+    struct Run {
+        int32_t x;
+        int32_t y_begin;
+        int32_t y_end;
+        int plate;
+    };
+
+    // Runs have to cover the map, ordered by x, then by y.
+    PlateRegions(int sizex, std::vector<Run> runs);
+
+    const std::vector<Run>& get_runs() const { return runs; }
+    // Root run of the region of the run.
+    int32_t root(int32_t run) const;
+    // Roots of all the regions, in the map order.
+    const std::vector<int32_t>& get_roots() const { return roots; }
+    int regions_cnt() const { return roots.size(); }
+
+    // Bands with less runs are not worth a thread.
+    static size_t band_runs_min;
+
+private:
+    // Find with path halving, for the runs owned by the caller only.
+    int32_t find_compress(int32_t i);
+    void unite(int32_t a, int32_t b);
+    // Unite overlapping runs of the same plate in rows x - 1 and x.
+    void unite_rows(int x);
+
+    std::vector<Run> runs;
+    // Runs of row x are runs[row_begin[x]..row_begin[x + 1]).
+    std::vector<int32_t> row_begin;
+    std::vector<int32_t> parent;
+    std::vector<int32_t> roots;
+};
+
+}
+
+#endif
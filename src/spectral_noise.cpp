@@ -0,0 +1,106 @@
+#include <bit>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include "spectral_noise.h"
+#include "fft.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace Noise;
+using namespace utils;
+
+namespace {
+    // splitmix64 of the index
+    uint64_t mix(uint64_t seed, uint64_t index) {
+        uint64_t z = seed + index * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+}
+
+SpectralNoise::SpectralNoise(int noise_min, int noise_max,
+                             int sizex, int sizey, float slope,
+                             uint32_t seed):
+    noise_min(noise_min) {
+    START()
+    const int rows = std::bit_ceil((unsigned)sizex);
+    const int columns = std::max(2u, std::bit_ceil((unsigned)sizey));
+    const FFT2D fft(rows, columns);
+    stride = fft.stride();
+    LOG_DEBUG(std::cout << "Spectral grid " << rows << " x " << columns
+                        << '\n';);
+    grid.resize((size_t)rows * stride);
+    const unsigned threads = threads_count();
+
+    // Amplitude is f^(-slope / 2), the power is f^-slope. Random parts
+    // are a hash of the bin index, so they don't depend on the threads.
+    // Bins of the columns 0 and columns / 2 are their own half spectrum:
+    // the bin of the row rows - r is the conjugate one of the row r,
+    // and the rows 0 and rows / 2 are real.
+    const float exponent = -slope / 4;
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        std::vector<float> amps(stride);
+        const auto [begin, end] = thread_range(rows, thread_idx, threads);
+        for (int r = begin; r < end; r++) {
+            const float fr = (float)std::min(r, rows - r) / rows;
+            for (int c = 0; c < stride; c++) {
+                const float fc = (float)c / columns;
+                const float f2 = fr * fr + fc * fc;
+                amps[c] = f2 == 0 ? 0 : std::pow(f2, exponent);
+            }
+            const int mirror = (rows - r) % rows;
+            std::complex<float> *row = grid.data() + (size_t)r * stride;
+            for (int c = 0; c < stride; c++) {
+                const bool own_half = c == 0 || c == columns / 2;
+                const int hashed = own_half ? std::min(r, mirror) : r;
+                // uniform in -1..1, the sum over the spectrum is gaussian anyway
+                const uint64_t hash = mix(seed, (uint64_t)hashed * stride + c);
+                const float re = (int32_t)hash * 0x1p-31f;
+                float im = (int32_t)(hash >> 32) * 0x1p-31f;
+                if (own_half && r == mirror) {
+                    im = 0;
+                } else if (own_half && r > mirror) {
+                    im = -im;
+                }
+                row[c] = {re * amps[c], im * amps[c]};
+            }
+        }
+    });
+
+    fft.inverse_real(grid.data());
+
+    std::vector<std::pair<float, float>> bounds(threads);
+    run_in_parallel(threads, [&](unsigned thread_idx) {
+        const auto [begin, end] = thread_range(sizex, thread_idx, threads);
+        float lo = INFINITY, hi = -INFINITY;
+        for (int x = begin; x < end; x++) {
+            for (int y = 0; y < sizey; y++) {
+                lo = std::min(lo, value(x, y));
+                hi = std::max(hi, value(x, y));
+            }
+        }
+        bounds[thread_idx] = {lo, hi};
+    });
+    float lo = INFINITY, hi = -INFINITY;
+    for (const auto &[thread_lo, thread_hi]: bounds) {
+        lo = std::min(lo, thread_lo);
+        hi = std::max(hi, thread_hi);
+    }
+    field_min = lo;
+    field_scale = hi > lo ? (noise_max - noise_min) / (hi - lo) : 0;
+}
+
+int32_t SpectralNoise::height(int x, int y) const {
+    int32_t res;
+    heights(x, y, y + 1, &res);
+    return res;
+}
+
+void SpectralNoise::heights(int x, int y_begin, int y_end,
+                            int32_t *out) const {
+    for (int y = y_begin; y < y_end; y++) {
+        *out++ = noise_min + (value(x, y) - field_min) * field_scale;
+    }
+}
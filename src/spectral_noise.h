@@ -0,0 +1,52 @@
+#ifndef SPECTRAL_NOISE_H
+#define SPECTRAL_NOISE_H
+
+#include <vector>
+#include <complex>
+#include <cstdint>
+
+namespace Noise {
+
+/*
+Heights of the whole map at once, by spectral synthesis: random complex
+amplitudes with the power 1 / f^slope go through the inverse FFT, the
+result is a periodic fractal field. O(N log N) for N cells instead of
+O(N * octaves) of the gradient noise, slope 2 is brownian-like relief,
+bigger slopes are smoother.
+The spectrum is Hermitian, so only its half is stored and the real
+inverse FFT writes the field in its place. The grid is padded to powers
+of two, the map is its corner. It takes 4 bytes a cell, up to 4 times
+the map: 4.3 GB for 20000 x 20000, padded to 32768 x 32768, and 1.1 GB
+for 16384 x 16384. Heights are
+stretched so the field minimum and maximum on the map are noise_min and
+noise_max.
+*/
+class SpectralNoise final {
+public:
+    SpectralNoise(int noise_min, int noise_max, int sizex, int sizey,
+                  float slope = 2.0f, uint32_t seed = 1337);
+
+    int32_t height(int x, int y) const;
+    // Heights of cells map[x][y_begin..y_end).
+    void heights(int x, int y_begin, int y_end, int32_t *out) const;
+
+private:
+    // Field in the cell, packed by FFT2D::inverse_real.
+    float value(int x, int y) const {
+        const std::complex<float> &pair = grid[(size_t)x * stride + y / 2];
+        return y % 2 ? pair.imag() : pair.real();
+    }
+
+    int noise_min;
+    // Complex values of a grid row.
+    int stride;
+    // The padded grid after the inverse FFT.
+    // Read in place, a copy of the map part costs more than it saves.
+    std::vector<std::complex<float>> grid;
+    // height = noise_min + (field - field_min) * field_scale
+    float field_min;
+    float field_scale;
+};
+
+}
+#endif
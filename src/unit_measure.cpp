@@ -5,9 +5,20 @@
 #include <charconv>
 #include <cassert>
 #include <string>
+#include <array>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <cstring>
 #include "logger.h"
 #include "generator.h"
+#include "noise.h"
 #include "measure.h"
+#include "vox_writer.h"
+#include "vox_export.h"
+#include "utils.h"
 
 namespace {
 
@@ -20,6 +31,18 @@ namespace {
     const std::string_view MID_OCEAN_RIDGE_CNT = "--mor-cnt=";
     const std::string_view DEEP_SEA_BASIN_CNT = "--basin-cnt=";
     const std::string_view CONTINENTAL_MARGIN_CNT = "--margin-cnt=";
+    const std::string_view SEED = "--seed=";
+    const std::string_view NOISE_STRIDE = "--noise-stride=";
+    const std::string_view NOISE = "--noise=";
+    const std::string_view OCTAVES = "--octaves=";
+    const std::string_view GAIN = "--gain=";
+    const std::string_view LACUNARITY = "--lacunarity=";
+    const std::string_view SLOPE = "--slope=";
+    const std::string_view EXPORT = "--export=";
+    const std::string_view KEYFRAME_YEARS = "--keyframe-years=";
+    const std::string_view SHARD_SIZE = "--shard-size=";
+    const std::string_view EXPORT_LOD = "--export-lod=";
+    const std::string_view LOD_FILTER = "--lod-filter=";
 
 }
 
@@ -33,6 +56,12 @@ std::optional<GenParams> parse_input(std::vector<std::string_view> input) {
         return res.ec != std::errc::invalid_argument &&
                res.ec != std::errc::result_out_of_range;
     };
+    auto str2float = [](std::string_view full, std::string_view extra, float &out) {
+        auto float_part = full.substr(extra.size());
+        auto res = std::from_chars(float_part.begin(), float_part.end(), out);
+        return res.ec != std::errc::invalid_argument &&
+               res.ec != std::errc::result_out_of_range;
+    };
 
     for (const auto param: input) {
         if(param.starts_with(SIZEX)) {
@@ -59,6 +88,60 @@ std::optional<GenParams> parse_input(std::vector<std::string_view> input) {
             if(!str2int(param, CONTINENTAL_MARGIN_CNT, res.margin_cnt)) return {};
             years = true;
         }
+        if(param.starts_with(SEED)) {
+            if(!str2int(param, SEED, res.seed)) return {};
+        }
+        if(param.starts_with(NOISE_STRIDE)) {
+            if(!str2int(param, NOISE_STRIDE, res.noise_stride)) return {};
+            if(res.noise_stride < 1) return {};
+        }
+        if(param.starts_with(NOISE)) {
+            auto type = param.substr(NOISE.size());
+            if(type == "perlin") res.noise_type = NoiseType::perlin;
+            else if(type == "fbm") res.noise_type = NoiseType::fbm;
+            else if(type == "ridged") res.noise_type = NoiseType::ridged;
+            else if(type == "fixed") res.noise_type = NoiseType::fixed;
+            else if(type == "spectral") res.noise_type = NoiseType::spectral;
+            else return {};
+        }
+        if(param.starts_with(OCTAVES)) {
+            if(!str2int(param, OCTAVES, res.noise_octaves)) return {};
+            if(res.noise_octaves < 1) return {};
+        }
+        if(param.starts_with(GAIN)) {
+            if(!str2float(param, GAIN, res.noise_gain)) return {};
+        }
+        if(param.starts_with(LACUNARITY)) {
+            if(!str2float(param, LACUNARITY, res.noise_lacunarity)) return {};
+        }
+        if(param.starts_with(SLOPE)) {
+            if(!str2float(param, SLOPE, res.noise_slope)) return {};
+        }
+        if(param.starts_with(EXPORT)) {
+            auto mode = param.substr(EXPORT.size());
+            if(mode == "solid") res.export_mode = ExportMode::solid;
+            else if(mode == "shell") res.export_mode = ExportMode::shell;
+            else return {};
+        }
+        if(param.starts_with(KEYFRAME_YEARS)) {
+            if(!str2int(param, KEYFRAME_YEARS, res.keyframe_years)) return {};
+            if(res.keyframe_years < 0) return {};
+        }
+        if(param.starts_with(SHARD_SIZE)) {
+            if(!str2int(param, SHARD_SIZE, res.shard_size)) return {};
+            if(res.shard_size < 0) return {};
+        }
+        if(param.starts_with(EXPORT_LOD)) {
+            if(!str2int(param, EXPORT_LOD, res.export_lod)) return {};
+            if(res.export_lod < 0 || res.export_lod > 16) return {};
+        }
+        if(param.starts_with(LOD_FILTER)) {
+            auto filter = param.substr(LOD_FILTER.size());
+            if(filter == "mean") res.lod_filter = LodFilter::mean;
+            else if(filter == "max") res.lod_filter = LodFilter::max;
+            else if(filter == "min") res.lod_filter = LodFilter::min;
+            else return {};
+        }
         if(param.starts_with(OUTPUT)) {
             res.file = param.substr(OUTPUT.size());
         }
@@ -91,11 +174,19 @@ void measure_elements(const GenParams& params) {
     g.set_properties(); \
     g.set_height(); \
     auto map = g.get_result(); \
+    BoundaryGraph boundaries{map}; \
     auto f = [&]() { std::make_unique<Unit>(__VA_ARGS__); }; \
     measure::do_bench(#Unit "Init", f); \
     auto unit = std::make_unique<Unit>(__VA_ARGS__); \
     auto ff = [&]() {unit->do_iteration(100);}; \
     measure::do_bench((#Unit "Iteration") + std::string(file_suffix), ff); \
+    auto run = [&]() { \
+        auto unit = std::make_unique<Unit>(__VA_ARGS__); \
+        for (int year = 0; year < params.years; year += 100) { \
+            unit->do_iteration(100); \
+        } \
+    }; \
+    measure::do_bench((#Unit "Run") + std::string(file_suffix), run, 1); \
 } while(0);
 
 {
@@ -116,15 +207,460 @@ void measure_elements(const GenParams& params) {
     int y = get_random_number_in_range(0, sizey - 1);
     LOG_INFO(std::cout << "Add Continental Margin {"
                         << x << ", " << y << "}\n";);
-    measureUnit(ContinentalMargin, map, x, y);
+    measureUnit(ContinentalMargin, map, g.get_plates_cells(), x, y);
 }
 {
     LOG_INFO(std::cout << "Add MidOceanRidge\n";);
-    measureUnit(MidOceanRidge, map);
+    measureUnit(MidOceanRidge, map, boundaries, boundaries.get_map_edges(),
+                params.years);
+
+    Generator g{params};
+    g.setup_map();
+    g.split_map();
+    g.set_properties();
+    g.set_height();
+    auto map = g.get_result();
+    BoundaryGraph boundaries{map};
+    MidOceanRidge ridge{map, boundaries, boundaries.get_map_edges(),
+                        params.years};
+    measure::print_memory("MidOceanRidgeMemory" + std::string(file_suffix), {
+        {"graph", ridge.graph_memory()},
+        {"bfs", ridge.bfs_memory()},
+    });
 }
 #undef measureUnit
 }
 
+void measure_boundary_graph(const GenParams& params) {
+    START();
+    // Strong scaling of BFS over the plate boundary graph:
+    // the same map and start, different number of threads.
+    const std::string file_suffix = params.file.data();
+
+    Generator g{params};
+    g.setup_map();
+    g.split_map();
+    auto map = g.get_result();
+    BoundaryGraph graph{map};
+    if (graph.get_map_edges().empty()) {
+        LOG_INFO(std::cout << "No plate boundaries on the map edge\n";);
+        return;
+    }
+    const auto start = graph.get_map_edges()[0];
+    BoundaryGraph::BfsState state;
+    state.resize(graph.vertex_cnt());
+
+    measure::do_bench("BoundaryGraphBfs" + file_suffix,
+                      [&]() { graph.bfs(start, state); }, 100);
+
+    const unsigned max_threads = threads_count();
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        set_threads_count(threads);
+        measure::do_bench("BoundaryGraphParallelBfs_" +
+                          std::to_string(threads) + file_suffix,
+                          [&]() { graph.parallel_bfs(start, state); }, 100);
+    }
+    set_threads_count(0);
+}
+
+void measure_distance_field(const GenParams& params) {
+    START();
+    const std::string file_suffix = params.file.data();
+
+    Generator g{params};
+    g.setup_map();
+    g.split_map();
+    auto map = g.get_result();
+    const unsigned boundaries =
+        DistanceField::plates_boundary | DistanceField::map_boundary;
+    const auto seeds = DistanceField::find_seeds(map, boundaries);
+
+    measure::do_bench("DistanceFieldSeeds" + file_suffix,
+                      [&]() { DistanceField::find_seeds(map, boundaries); }, 10);
+
+    const unsigned max_threads = threads_count();
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        set_threads_count(threads);
+        const std::string name_suffix = "_" + std::to_string(threads) +
+                                        file_suffix;
+        measure::do_bench("DistanceFieldManhattan" + name_suffix, [&]() {
+            DistanceField{params.sizex, params.sizey, seeds,
+                          DistanceField::Metric::manhattan};
+        }, 10);
+        measure::do_bench("DistanceFieldEuclidean" + name_suffix, [&]() {
+            DistanceField{params.sizex, params.sizey, seeds,
+                          DistanceField::Metric::euclidean};
+        }, 10);
+    }
+    set_threads_count(0);
+}
+
+void measure_noise(const GenParams& params) {
+    START();
+    // Full map of initial heights, exact and interpolated
+    // from the coarse lattice.
+    const std::string file_suffix = params.file.data();
+    std::vector<int32_t> row(params.sizey);
+    for (int stride = 1; stride <= 16; stride *= 2) {
+        measure::do_bench("HeightNoise_" + std::to_string(stride) + file_suffix,
+                          [&]() {
+            const Noise::HeightNoise noise(initial_min_height,
+                                           initial_max_height,
+                                           params.sizex, params.sizey, stride);
+            for (int x = 0; x < params.sizex; x++) {
+                noise.heights(x, 0, params.sizey, row.data());
+            }
+        }, 10);
+    }
+}
+
+void measure_fractal_noise(const GenParams& params) {
+    START();
+    // Sweep over gain: the first run evaluates all the octaves,
+    // the others only sum the cached ones.
+    const std::string file_suffix = params.file.data();
+    Noise::set_octave_cache_limit(size_t(1) << 30);
+    for (NoiseType type: {NoiseType::fbm, NoiseType::ridged}) {
+        const std::string name = type == NoiseType::fbm ? "fbm" : "ridged";
+        for (float gain: {0.5f, 0.4f, 0.6f}) {
+            const Noise::Fractal fractal {type, params.noise_octaves, gain,
+                                          params.noise_lacunarity};
+            measure::do_bench(name + "_gain_" + std::to_string(gain) +
+                              file_suffix, [&]() {
+                const Noise::HeightNoise noise(initial_min_height,
+                                               initial_max_height,
+                                               params.sizex, params.sizey,
+                                               params.noise_stride, fractal);
+            }, 1);
+        }
+    }
+    Noise::set_octave_cache_limit(0);
+}
+
+void measure_fixed_noise(const GenParams& params) {
+    START();
+    // Every kernel the CPU has, against the float noise.
+    // The kernels have to give the same heights.
+    const std::string file_suffix = params.file.data();
+    using Kernel = Noise::FixedNoise::Kernel;
+    const Noise::FixedNoise fixed(initial_min_height, initial_max_height,
+                                  params.sizey);
+    std::vector<Kernel> kernels {Kernel::scalar};
+    if (Noise::FixedNoise::best_kernel() != Kernel::scalar) {
+        kernels.push_back(Kernel::sse);
+    }
+    if (Noise::FixedNoise::best_kernel() == Kernel::avx2) {
+        kernels.push_back(Kernel::avx2);
+    }
+    const std::array<std::string, 3> names {"scalar", "sse", "avx2"};
+
+    std::vector<int32_t> expected((size_t)params.sizex * params.sizey);
+    std::vector<int32_t> heights(expected.size());
+    for (Kernel kernel: kernels) {
+        measure::do_bench("FixedNoise_" + names[(int)kernel] + file_suffix,
+                          [&]() {
+            for (int x = 0; x < params.sizex; x++) {
+                fixed.heights(x, 0, params.sizey,
+                              heights.data() + (size_t)x * params.sizey,
+                              kernel);
+            }
+        }, 10);
+        if (kernel == Kernel::scalar) {
+            expected = heights;
+        } else if (heights != expected) {
+            std::cerr << "FixedNoise: " << names[(int)kernel]
+                      << " differs from scalar\n";
+            std::exit(1);
+        }
+    }
+    measure::do_bench("FloatNoise" + file_suffix, [&]() {
+        const Noise::HeightNoise noise(initial_min_height, initial_max_height,
+                                       params.sizex, params.sizey);
+        for (int x = 0; x < params.sizex; x++) {
+            noise.heights(x, 0, params.sizey,
+                          heights.data() + (size_t)x * params.sizey);
+        }
+    }, 10);
+}
+
+void measure_spectral_noise(const GenParams& params) {
+    START();
+    // Whole map of heights, big maps only: spectral synthesis against
+    // perlin and fbm of the same octaves.
+    const std::string file_suffix = params.file.data();
+    for (int size: {4096, 8192, 16384}) {
+        std::vector<int32_t> row(size);
+        const std::string size_name = "_" + std::to_string(size);
+        auto bench = [&](const std::string &name, Noise::Fractal fractal) {
+            measure::do_bench(name + size_name + file_suffix, [&]() {
+                const Noise::HeightNoise noise(initial_min_height,
+                                               initial_max_height,
+                                               size, size, 1, fractal);
+                for (int x = 0; x < size; x++) {
+                    noise.heights(x, 0, size, row.data());
+                }
+            }, 1);
+        };
+        bench("Spectral", {NoiseType::spectral, 1, 0.5f, 2.0f,
+                           params.noise_slope});
+        bench("Perlin", {});
+        bench("Fbm", {NoiseType::fbm, params.noise_octaves});
+    }
+}
+
+// Voxels of a .vox of VoxWriter at their places in the scene, the cube
+// translation added: their count and the sum of their hashes, the same
+// for the same voxels in any cubes and files.
+std::pair<size_t, uint64_t> scene_voxels(const std::string &file) {
+    std::ifstream in(file, std::ios::binary);
+    const std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                                  std::istreambuf_iterator<char>());
+    auto read_int = [&](size_t &at) {
+        int32_t value;
+        std::memcpy(&value, bytes.data() + at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    };
+    auto read_string = [&](size_t &at) {
+        const int32_t size = read_int(at);
+        at += size;
+        return std::string(bytes.data() + at - size, size);
+    };
+    auto skip_dict = [&](size_t &at) {
+        for (int32_t pairs = read_int(at); pairs > 0; pairs--) {
+            read_string(at);
+            read_string(at);
+        }
+    };
+    auto mix = [](uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    };
+
+    std::vector<size_t> models;
+    int32_t tx = 0, ty = 0, tz = 0;
+    size_t count = 0;
+    uint64_t sum = 0;
+    // "VOX ", the version, then the chunks in MAIN
+    for (size_t chunk = 8 + 12; chunk + 12 <= bytes.size();) {
+        const std::string_view id(bytes.data() + chunk, 4);
+        size_t at = chunk + 4;
+        const int32_t size = read_int(at);
+        at += sizeof(int32_t);
+        chunk = at + size;
+        if (id == "XYZI") {
+            models.push_back(at);
+        } else if (id == "nTRN") {
+            read_int(at);
+            skip_dict(at);
+            at += 3 * sizeof(int32_t);
+            for (int32_t frames = read_int(at); frames > 0; frames--) {
+                for (int32_t pairs = read_int(at); pairs > 0; pairs--) {
+                    const std::string key = read_string(at);
+                    const std::string value = read_string(at);
+                    if (key == "_t") {
+                        std::sscanf(value.c_str(), "%d %d %d", &tx, &ty, &tz);
+                    }
+                }
+            }
+        } else if (id == "nSHP") {
+            read_int(at);
+            skip_dict(at);
+            read_int(at);
+            size_t voxel = models[read_int(at)];
+            for (int32_t voxels = read_int(voxel); voxels > 0; voxels--) {
+                const auto *xyzi = (const uint8_t *)bytes.data() + voxel;
+                uint64_t h = mix((uint64_t)(uint32_t)(tx + xyzi[0]));
+                h = mix(h + (uint32_t)(ty + xyzi[1]));
+                h = mix(h + (uint32_t)(tz + xyzi[2]));
+                sum += mix(h + xyzi[3]);
+                count++;
+                voxel += 4;
+            }
+        }
+    }
+    return {count, sum};
+}
+
+void measure_vox_writer(const GenParams& params) {
+    START();
+    // Solid columns of the initial heights voxel by voxel, with and
+    // without the dedupe, and as a whole height field.
+    const std::string file_suffix = params.file.data();
+    const Noise::HeightNoise noise(initial_min_height, initial_max_height,
+                                   params.sizex, params.sizey);
+    std::vector<int32_t> heights((size_t)params.sizex * params.sizey);
+    size_t voxels = 0;
+    for (int x = 0; x < params.sizex; x++) {
+        int32_t *row = heights.data() + (size_t)x * params.sizey;
+        noise.heights(x, 0, params.sizey, row);
+        for (int y = 0; y < params.sizey; y++) {
+            voxels += row[y];
+        }
+    }
+
+    for (bool dedupe: {true, false}) {
+        const std::string name = dedupe ? "VoxWriterDedupe" : "VoxWriterUnique";
+        auto tc = measure::time_measure([&]() {
+            vox::VoxWriter vox;
+            vox.SetDeduplication(dedupe);
+            for (int x = 0; x < params.sizex; x++) {
+                for (int y = 0; y < params.sizey; y++) {
+                    const int32_t h = heights[(size_t)x * params.sizey + y];
+                    for (int32_t z = 0; z < h; z++) {
+                        vox.AddVoxel(x, y, z, 1);
+                    }
+                }
+            }
+        }, 3);
+        measure::print_stats(name + file_suffix, tc);
+        const double best = std::min_element(tc.begin(), tc.end())->count();
+        LOG_INFO(std::cout << name << ": " << voxels / best
+                           << " voxels/s\n";);
+    }
+
+    const std::vector<uint8_t> colors(heights.size(), 1);
+    auto tc = measure::time_measure([&]() {
+        vox::VoxWriter vox;
+        vox.SetDeduplication(false);
+        vox.AddHeightField({(size_t)params.sizex, (size_t)params.sizey,
+                            heights.data(), colors.data()});
+    }, 3);
+    measure::print_stats("VoxWriterHeightField" + file_suffix, tc);
+    const double best = std::min_element(tc.begin(), tc.end())->count();
+    LOG_INFO(std::cout << "VoxWriterHeightField: " << voxels / best
+                       << " voxels/s\n";);
+
+    // Streaming save into the output file, the cubes encoded on 1, 2, 4..
+    // threads up to all of them.
+    std::vector<unsigned> threads_counts;
+    for (unsigned threads = 1; threads < utils::threads_count(); threads *= 2) {
+        threads_counts.push_back(threads);
+    }
+    threads_counts.push_back(utils::threads_count());
+    for (unsigned threads: threads_counts) {
+        const std::string name = "VoxWriterSave" + std::to_string(threads);
+        auto tc = measure::time_measure([&]() {
+            vox::VoxWriter vox;
+            vox.SetThreadsCount(threads);
+            vox.SaveHeightFieldToFile({(size_t)params.sizex, (size_t)params.sizey,
+                                       heights.data(), colors.data()},
+                                      file_suffix);
+        }, 3);
+        measure::print_stats(name + file_suffix, tc);
+        const double best = std::min_element(tc.begin(), tc.end())->count();
+        LOG_INFO(std::cout << name << ": " << voxels / best
+                           << " voxels/s\n";);
+    }
+
+    // The same into shards, a pool of writers with one thread each.
+    HeightField field;
+    field.sizex = params.sizex;
+    field.sizey = params.sizey;
+    field.heights = heights;
+    field.colors = colors;
+    const int shard_size = params.shard_size > 0 ? params.shard_size : 1000;
+    for (unsigned threads: threads_counts) {
+        const std::string name = "VoxWriterShards" + std::to_string(threads);
+        auto tc = measure::time_measure([&]() {
+            export_vox_shards(field, ExportMode::solid, file_suffix,
+                              shard_size, threads);
+        }, 3);
+        measure::print_stats(name + file_suffix, tc);
+        const double best = std::min_element(tc.begin(), tc.end())->count();
+        LOG_INFO(std::cout << name << ": " << voxels / best
+                           << " voxels/s\n";);
+    }
+    // The shards together have to be the single file, voxel by voxel.
+    std::pair<size_t, uint64_t> shards_voxels {0, 0};
+    for (int x = 0; x * shard_size < params.sizex; x++) {
+        for (int y = 0; y * shard_size < params.sizey; y++) {
+            const auto [count, sum] =
+                scene_voxels(shard_file(file_suffix, x, y));
+            shards_voxels.first += count;
+            shards_voxels.second += sum;
+        }
+    }
+    if (shards_voxels != scene_voxels(file_suffix)) {
+        std::cerr << "VoxWriterShards: the shards differ from the single"
+                     " file\n";
+        std::exit(1);
+    }
+
+    // Overview exports, the downsampling alone and with the save.
+    for (int lod = 1; lod <= 3; lod++) {
+        const std::string name = "VoxWriterLod" + std::to_string(lod);
+        auto tc_downsample = measure::time_measure([&]() {
+            downsample(field, lod, LodFilter::mean, utils::threads_count());
+        }, 3);
+        measure::print_stats(name + "Downsample" + file_suffix, tc_downsample);
+        auto tc = measure::time_measure([&]() {
+            export_vox(downsample(field, lod, LodFilter::mean,
+                                  utils::threads_count()),
+                       ExportMode::solid, file_suffix, utils::threads_count());
+        }, 3);
+        measure::print_stats(name + file_suffix, tc);
+        LOG_INFO(std::cout << name << ": downsample "
+                           << std::min_element(tc_downsample.begin(),
+                                               tc_downsample.end())->count()
+                           << " s, with the save "
+                           << std::min_element(tc.begin(), tc.end())->count()
+                           << " s\n";);
+    }
+}
+
+void measure_keyframe_writer(const GenParams& params) {
+    START();
+    // The whole generation with a keyframe every tenth of the years:
+    // without keyframes, writing them in the simulation thread and
+    // with the background writer. Overlap is the part of the writing
+    // hidden behind the simulation.
+    const int every_years = std::max(100, params.years / 1000 * 100);
+    const std::string file(params.file);
+    std::vector<int> years_written;
+    auto generate = [&](const std::function<void(int, const Map&)> &handler,
+                        const std::function<void()> &done) {
+        auto tc = measure::time_measure([&]() {
+            Generator g{params};
+            if (handler) {
+                g.set_keyframes(every_years, handler);
+            }
+            g.generate();
+            if (done) {
+                done();
+            }
+        }, 1);
+        return tc.front().count();
+    };
+
+    const double plain = generate(nullptr, nullptr);
+    HeightField field;
+    const double sync = generate([&](int year, const Map &map) {
+        field.assign(map);
+        export_vox(field, params.export_mode, keyframe_file(file, year), 1);
+        years_written.push_back(year);
+    }, nullptr);
+    KeyframeWriter writer(file, params.export_mode);
+    const double async = generate([&](int year, const Map &map) {
+        writer.push(year, map);
+    }, [&]() { writer.finish(); });
+    const double wait = writer.get_wait_time();
+    for (int year: years_written) {
+        std::remove(keyframe_file(file, year).c_str());
+    }
+
+    const double writing = sync - plain;
+    LOG_INFO(std::cout << "Keyframes: " << years_written.size()
+                       << "\nKeyframesNone: " << plain
+                       << " s\nKeyframesSync: " << sync
+                       << " s\nKeyframesAsync: " << async
+                       << " s, waited " << wait
+                       << " s\nKeyframesOverlap: "
+                       << (writing > 0 ? 100 * (sync - async) / writing : 0)
+                       << " %\n";);
+}
+
 void measure_generator(const GenParams& params) {
 
     const char *file_suffix = params.file.data();
@@ -141,10 +677,18 @@ void measure_generator(const GenParams& params) {
 
     measureMethod(setup_map);
     measureMethod(split_map);
+    measureMethod(split_regions);
+    measureMethod(analyse_boundaries);
     measureMethod(set_properties);
+    measureMethod(classify_boundaries);
     measureMethod(set_height);
 
 #undef measureMethod
+
+    // Fused version of setup_map, split_map and set_height
+    Generator g{params};
+    measure::do_bench("init_map" + std::string(file_suffix),
+                      [&]() { g.init_map(); });
 }
 
 int main(int argc, char **argv) {
@@ -157,7 +701,19 @@ int main(int argc, char **argv) {
                   << "[ " << OUTPUT << "file ] "
                   << "[ " << MID_OCEAN_RIDGE_CNT << "cnt ] "
                   << "[ " << DEEP_SEA_BASIN_CNT << "cnt ] "
-                  << "[ " << CONTINENTAL_MARGIN_CNT << "cnt ]\n";
+                  << "[ " << CONTINENTAL_MARGIN_CNT << "cnt ] "
+                  << "[ " << SEED << "N ] "
+                  << "[ " << NOISE_STRIDE << "N ] "
+                  << "[ " << NOISE << "perlin|fbm|ridged|fixed|spectral ] "
+                  << "[ " << OCTAVES << "N ] "
+                  << "[ " << GAIN << "F ] "
+                  << "[ " << LACUNARITY << "F ] "
+                  << "[ " << SLOPE << "F ] "
+                  << "[ " << EXPORT << "solid|shell ] "
+                  << "[ " << KEYFRAME_YEARS << "N ] "
+                  << "[ " << SHARD_SIZE << "N ] "
+                  << "[ " << EXPORT_LOD << "k ] "
+                  << "[ " << LOD_FILTER << "mean|max|min ]\n";
 
         return 0;
     }
@@ -181,6 +737,14 @@ int main(int argc, char **argv) {
 
     measure_generator(params);
     measure_elements(params);
+    measure_boundary_graph(params);
+    measure_distance_field(params);
+    measure_noise(params);
+    measure_fractal_noise(params);
+    measure_fixed_noise(params);
+    measure_spectral_noise(params);
+    measure_vox_writer(params);
+    measure_keyframe_writer(params);
 
     return 0;
 }
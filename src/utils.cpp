@@ -4,6 +4,8 @@
 #include <random>
 #include <vector>
 #include <set>
+#include <thread>
+#include <algorithm>
 #include "utils.h"
 
 namespace utils {
@@ -21,11 +23,23 @@ Voxel* p_voxel_from_point(Map& map, Point p) {
     return &map[p.x][p.y];
 }
 
+namespace {
+
+std::mt19937& random_engine() {
+    // seeded from hardware, unless set_random_seed is called
+    static std::mt19937 gen(std::random_device{}());
+    return gen;
+}
+
+}
+
+void set_random_seed(unsigned seed) {
+    random_engine().seed(seed);
+}
+
 int get_random_number_in_range(int l, int r) {
-    std::random_device rd; // obtain a random number from hardware
-    std::mt19937 gen(rd()); // seed the generator
     std::uniform_int_distribution<> distr(l, r); // define the range
-    return distr(gen);
+    return distr(random_engine());
 }
 
 Point create_random_point(int xmin, int xmax, int ymin, int ymax) {
@@ -33,6 +47,42 @@ Point create_random_point(int xmin, int xmax, int ymin, int ymax) {
              get_random_number_in_range(ymin, ymax) };
 }
 
+namespace {
+
+unsigned threads_override = 0;
+
+}
+
+unsigned threads_count() {
+    if (threads_override) {
+        return threads_override;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void set_threads_count(unsigned threads) {
+    threads_override = threads;
+}
+
+void run_in_parallel(unsigned threads,
+                     const std::function<void(unsigned)> &f) {
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(f, i);
+    }
+    f(0);
+    for (auto &w: workers) {
+        w.join();
+    }
+}
+
+std::pair<int, int> thread_range(int size, unsigned thread_idx,
+                                 unsigned threads) {
+    return {(int)((int64_t)size * thread_idx / threads),
+            (int)((int64_t)size * (thread_idx + 1) / threads)};
+}
+
 # if 0
 std::optional<Point> bfs(const Map& map, Point start) {
     std::queue<Point> q;
@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include <optional>
+#include <functional>
+#include <utility>
 #include "common.h"
 namespace utils {
 
@@ -30,10 +32,33 @@ Voxel voxel_from_point(const Map& map, Point p);
 
 Voxel* p_voxel_from_point(Map& map, Point p);
 
+void set_random_seed(unsigned seed);
+
 int get_random_number_in_range(int l, int r);
 
 Point create_random_point(int xmin, int xmax, int ymin, int ymax);
 
+// Number of threads for parallel parts of generation,
+// hardware concurrency unless set with set_threads_count.
+unsigned threads_count();
+
+void set_threads_count(unsigned threads);
+
+// Call f(thread_idx) for thread_idx in [0, threads),
+// the calling thread does thread_idx = 0.
+void run_in_parallel(unsigned threads,
+                     const std::function<void(unsigned)> &f);
+
+// [begin, end) of the thread, when [0, size) is split into
+// contiguous chunks.
+std::pair<int, int> thread_range(int size, unsigned thread_idx,
+                                 unsigned threads);
+
+// Columns the column passes of 2D transforms copy out and transform
+// together: rows of the block share cache lines, 16 values of 8 bytes
+// are two of them.
+const int columns_block = 16;
+
 #if 0
 std::optional<Point> bfs(const Map& map, Point start);
 #endif
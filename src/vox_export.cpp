@@ -0,0 +1,330 @@
+#include <chrono>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+#include "vox_export.h"
+#include "vox_writer.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace generation;
+
+void HeightField::assign(const Map &map) {
+    sizex = map.size();
+    sizey = map[0].size();
+    heights.resize(sizex * sizey);
+    colors.resize(sizex * sizey);
+    for (size_t x = 0; x < sizex; ++x) {
+        for (size_t y = 0; y < sizey; ++y) {
+            heights[x * sizey + y] = map[x][y].z;
+            colors[x * sizey + y] = map[x][y].color;
+        }
+    }
+}
+
+namespace {
+
+// a / b to the nearest, b > 0.
+int64_t divide_rounded(int64_t a, int64_t b) {
+    return a >= 0 ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+}
+
+HeightField generation::downsample(const HeightField &field, int lod,
+                                   LodFilter filter, unsigned threads) {
+    START();
+    const size_t block = (size_t)1 << lod;
+    // Copied into the threads: for the compiler, a store to the int64
+    // sums could change a size_t read by reference, then the loops over y
+    // are not vectorized.
+    const size_t sizey = field.sizey;
+    HeightField res;
+    res.sizex = (field.sizex + block - 1) / block;
+    res.sizey = (sizey + block - 1) / block;
+    res.heights.resize(res.sizex * res.sizey);
+    res.colors.resize(res.sizex * res.sizey);
+
+    threads = std::max<size_t>(1, std::min<size_t>(threads, res.sizex));
+    utils::run_in_parallel(threads, [&, sizey](unsigned thread_idx) {
+        // Over the block rows for every y: sums for the mean,
+        // max or min for the others.
+        std::vector<int64_t> sums;
+        std::vector<int32_t> extremes;
+        std::array<uint32_t, 256> counts{};
+        for (size_t x_out = res.sizex * thread_idx / threads;
+             x_out < res.sizex * (thread_idx + 1) / threads; x_out++) {
+            const size_t x_begin = x_out * block;
+            const size_t x_end = std::min(x_begin + block, field.sizex);
+            const int32_t *first = field.heights.data() + x_begin * sizey;
+            if (filter == LodFilter::mean) {
+                sums.assign(first, first + sizey);
+            } else {
+                extremes.assign(first, first + sizey);
+            }
+            for (size_t x = x_begin + 1; x < x_end; x++) {
+                const int32_t *row = field.heights.data() + x * sizey;
+                if (filter == LodFilter::mean) {
+                    int64_t *out = sums.data();
+                    for (size_t y = 0; y < sizey; y++) {
+                        out[y] += row[y];
+                    }
+                } else if (filter == LodFilter::max) {
+                    int32_t *out = extremes.data();
+                    for (size_t y = 0; y < sizey; y++) {
+                        out[y] = std::max(out[y], row[y]);
+                    }
+                } else {
+                    int32_t *out = extremes.data();
+                    for (size_t y = 0; y < sizey; y++) {
+                        out[y] = std::min(out[y], row[y]);
+                    }
+                }
+            }
+
+            for (size_t y_out = 0; y_out < res.sizey; y_out++) {
+                const size_t y_begin = y_out * block;
+                const size_t y_end = std::min(y_begin + block, sizey);
+                int64_t value = 0;
+                int64_t divisor = block;
+                if (filter == LodFilter::mean) {
+                    value = std::accumulate(sums.begin() + y_begin,
+                                            sums.begin() + y_end, (int64_t)0);
+                    divisor *= (x_end - x_begin) * (y_end - y_begin);
+                } else if (filter == LodFilter::max) {
+                    value = *std::max_element(extremes.begin() + y_begin,
+                                              extremes.begin() + y_end);
+                } else {
+                    value = *std::min_element(extremes.begin() + y_begin,
+                                              extremes.begin() + y_end);
+                }
+
+                uint8_t color = 0;
+                uint32_t color_cnt = 0;
+                for (size_t x = x_begin; x < x_end; x++) {
+                    const uint8_t *colors =
+                        field.colors.data() + x * sizey;
+                    for (size_t y = y_begin; y < y_end; y++) {
+                        const uint32_t cnt = ++counts[colors[y]];
+                        if (cnt > color_cnt ||
+                            (cnt == color_cnt && colors[y] < color)) {
+                            color = colors[y];
+                            color_cnt = cnt;
+                        }
+                    }
+                }
+                for (size_t x = x_begin; x < x_end; x++) {
+                    const uint8_t *colors =
+                        field.colors.data() + x * sizey;
+                    for (size_t y = y_begin; y < y_end; y++) {
+                        counts[colors[y]] = 0;
+                    }
+                }
+
+                const size_t i = x_out * res.sizey + y_out;
+                res.heights[i] = divide_rounded(value, divisor);
+                res.colors[i] = color;
+            }
+        }
+    });
+    return res;
+}
+
+void generation::export_vox(const HeightField &field, ExportMode mode,
+                            const std::string &file, unsigned threads) {
+    vox::HeightFieldView view {field.sizex, field.sizey,
+                               field.heights.data(), field.colors.data()};
+    std::vector<int32_t> bottoms;
+    if (mode == ExportMode::shell) {
+        bottoms = vox::GetShellBottoms(view);
+        view.bottoms = bottoms.data();
+    }
+    vox::VoxWriter vox;
+    vox.SetThreadsCount(threads);
+    // cubes are encoded from the heights while writing, not held
+    vox.SaveHeightFieldToFile(view, file);
+}
+
+void generation::export_vox_shards(const HeightField &field, ExportMode mode,
+                                   const std::string &file, int shard_size,
+                                   unsigned threads) {
+    START();
+    vox::HeightFieldView map_view {field.sizex, field.sizey,
+                                   field.heights.data(), field.colors.data()};
+    std::vector<int32_t> bottoms;
+    if (mode == ExportMode::shell) {
+        bottoms = vox::GetShellBottoms(map_view);
+        map_view.bottoms = bottoms.data();
+    }
+    // the cubes of every shard are put where the single file has them
+    const vox::HeightFieldFrame map_frame =
+        vox::VoxWriter().GetHeightFieldFrame(map_view);
+    const size_t shard = shard_size;
+    const size_t shards_x = (field.sizex + shard - 1) / shard;
+    const size_t shards_y = (field.sizey + shard - 1) / shard;
+    const size_t shards_cnt = shards_x * shards_y;
+
+    std::atomic<size_t> next_shard = 0;
+    utils::run_in_parallel(std::min<size_t>(threads, shards_cnt),
+                           [&](unsigned) {
+        HeightField region;
+        std::vector<int32_t> region_bottoms;
+        for (size_t i = next_shard++; i < shards_cnt; i = next_shard++) {
+            const size_t x0 = i / shards_y * shard;
+            const size_t y0 = i % shards_y * shard;
+            region.sizex = std::min(shard, field.sizex - x0);
+            region.sizey = std::min(shard, field.sizey - y0);
+            region.heights.resize(region.sizex * region.sizey);
+            region.colors.resize(region.sizex * region.sizey);
+            region_bottoms.resize(bottoms.empty() ? 0 : region.heights.size());
+            for (size_t x = 0; x < region.sizex; x++) {
+                const size_t from = (x0 + x) * field.sizey + y0;
+                const size_t to = x * region.sizey;
+                std::copy_n(field.heights.begin() + from, region.sizey,
+                            region.heights.begin() + to);
+                std::copy_n(field.colors.begin() + from, region.sizey,
+                            region.colors.begin() + to);
+                if (!bottoms.empty()) {
+                    std::copy_n(bottoms.begin() + from, region.sizey,
+                                region_bottoms.begin() + to);
+                }
+            }
+
+            vox::HeightFieldView view {region.sizex, region.sizey,
+                                       region.heights.data(),
+                                       region.colors.data()};
+            if (!bottoms.empty()) {
+                view.bottoms = region_bottoms.data();
+            }
+            vox::HeightFieldFrame frame = map_frame;
+            frame.originX = x0;
+            frame.originY = y0;
+            vox::VoxWriter vox;
+            vox.SetThreadsCount(1);
+            vox.SaveHeightFieldToFile(view, shard_file(file, x0 / shard,
+                                                       y0 / shard), &frame);
+        }
+    });
+
+    std::ofstream manifest(manifest_file(file));
+    manifest << "# shards " << shards_cnt << " map " << field.sizex << ' '
+             << field.sizey << " shard_size " << shard << '\n'
+             << "# file x_begin y_begin x_end y_end\n";
+    for (size_t i = 0; i < shards_cnt; i++) {
+        const size_t x0 = i / shards_y * shard;
+        const size_t y0 = i % shards_y * shard;
+        const size_t x1 = std::min(x0 + shard, field.sizex);
+        const size_t y1 = std::min(y0 + shard, field.sizey);
+        // Voxel x, y of a shard is x + x_begin, y + y_begin in the map,
+        // the files are next to the manifest.
+        const std::string name = shard_file(file, x0 / shard, y0 / shard);
+        manifest << name.substr(name.find_last_of("/\\") + 1) << ' '
+                 << x0 << ' ' << y0 << ' ' << x1 << ' ' << y1 << '\n';
+    }
+    LOG_DEBUG(std::cout << "Shards: " << shards_cnt << '\n';);
+}
+
+namespace {
+
+// Position of the extension dot, the end if there is no extension.
+size_t extension_begin(std::string_view file) {
+    const size_t dot = file.rfind('.');
+    const size_t slash = file.find_last_of("/\\");
+    if (dot == std::string_view::npos ||
+        (slash != std::string_view::npos && dot < slash)) {
+        return file.size();
+    }
+    return dot;
+}
+
+std::string with_suffix(std::string_view file, const std::string &suffix) {
+    const size_t dot = extension_begin(file);
+    return std::string(file.substr(0, dot)) + suffix +
+           std::string(file.substr(dot));
+}
+
+}
+
+std::string generation::keyframe_file(std::string_view file, int year) {
+    return with_suffix(file, '_' + std::to_string(year));
+}
+
+std::string generation::shard_file(std::string_view file,
+                                   int shard_x, int shard_y) {
+    return with_suffix(file, '_' + std::to_string(shard_x) +
+                             '_' + std::to_string(shard_y));
+}
+
+std::string generation::manifest_file(std::string_view file) {
+    return std::string(file.substr(0, extension_begin(file))) + ".manifest";
+}
+
+KeyframeWriter::KeyframeWriter(std::string file, ExportMode mode,
+                               size_t queue_size):
+    file(std::move(file)), mode(mode),
+    free_slots(std::max<size_t>(1, queue_size)) {
+    thread = std::thread(&KeyframeWriter::run, this);
+}
+
+KeyframeWriter::~KeyframeWriter() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+void KeyframeWriter::push(int year, const Map &map) {
+    START();
+    Keyframe keyframe;
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !free_slots.empty(); });
+        keyframe = std::move(free_slots.back());
+        free_slots.pop_back();
+        wait_time += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    // The copy is the only part the simulation waits for.
+    keyframe.year = year;
+    keyframe.field.assign(map);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back(std::move(keyframe));
+    }
+    changed.notify_all();
+}
+
+void KeyframeWriter::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return queued.empty() && !writing; });
+}
+
+void KeyframeWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this]() { return stopped || !queued.empty(); });
+        if (queued.empty()) {
+            return;
+        }
+        Keyframe keyframe = std::move(queued.front());
+        queued.pop_front();
+        writing = true;
+        lock.unlock();
+
+        const std::string name = keyframe_file(file, keyframe.year);
+        LOG_DEBUG(std::cout << "Writing keyframe " << name << '\n';);
+        // One thread, the cores are busy with the simulation.
+        export_vox(keyframe.field, mode, name, 1);
+
+        lock.lock();
+        free_slots.push_back(std::move(keyframe));
+        writing = false;
+        changed.notify_all();
+    }
+}
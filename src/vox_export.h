@@ -0,0 +1,102 @@
+#ifndef VOX_EXPORT_H
+#define VOX_EXPORT_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "common.h"
+
+namespace generation {
+
+// Heights and colors of the map cells, indexed x * sizey + y,
+// the layout VoxWriter takes.
+struct HeightField final {
+    size_t sizex = 0;
+    size_t sizey = 0;
+    std::vector<int32_t> heights;
+    std::vector<uint8_t> colors;
+
+    // Copy of the map, the buffers are reused.
+    void assign(const Map &map);
+};
+
+/*
+Level of detail: every 2^lod x 2^lod block of cells becomes one cell,
+its height is the mean, the max or the min of the block divided by 2^lod,
+so the landscape keeps its proportions, and its color is the most
+frequent one of the block, the smallest on ties. Blocks on the far
+edges may be cut. Rows of the blocks are reduced by plain loops over y,
+they are vectorized, the output rows are split between the threads.
+*/
+HeightField downsample(const HeightField &field, int lod, LodFilter filter,
+                       unsigned threads);
+
+void export_vox(const HeightField &field, ExportMode mode,
+                const std::string &file, unsigned threads);
+
+/*
+The map split into shard_size x shard_size regions, every region is a
+.vox of its own, file with _<x>_<y> of the region before the extension.
+The regions are written by a pool of threads, one VoxWriter each. Shell
+bottoms are found on the whole map, so the borders of the regions are
+the same as in a single file, and the cubes of the regions get the
+translations of the single file, so the regions opened together are the
+map. The manifest, file with .manifest instead of the extension, lists
+the regions: their files and their bounds in the map.
+*/
+void export_vox_shards(const HeightField &field, ExportMode mode,
+                       const std::string &file, int shard_size,
+                       unsigned threads);
+
+// file with _<year> before the extension.
+std::string keyframe_file(std::string_view file, int year);
+std::string shard_file(std::string_view file, int shard_x, int shard_y);
+std::string manifest_file(std::string_view file);
+
+/*
+Writes keyframes of the simulation on a background thread.
+push copies the heights into a free slot and returns, the thread writes
+the slots in order and frees them. There are queue_size slots, 2 is the
+double buffer: one is written while the next is filled. When all of them
+wait for the writer, push waits too, so the memory stays bounded.
+*/
+class KeyframeWriter final {
+public:
+    KeyframeWriter(std::string file, ExportMode mode, size_t queue_size = 2);
+    ~KeyframeWriter();
+
+    void push(int year, const Map &map);
+    // Waits until the pushed keyframes are written.
+    void finish();
+
+    // Time push waited for a free slot, in seconds.
+    double get_wait_time() const { return wait_time; }
+
+private:
+    struct Keyframe {
+        int year;
+        HeightField field;
+    };
+
+    void run();
+
+    std::string file;
+    ExportMode mode;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Keyframe> queued;
+    std::vector<Keyframe> free_slots;
+    bool writing = false;
+    bool stopped = false;
+    double wait_time = 0;
+    std::thread thread;
+};
+
+}
+
+#endif
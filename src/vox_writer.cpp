@@ -31,16 +31,53 @@
 #include "vox_writer.h"
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#if !_MSC_VER
+#include <unistd.h>
+#endif
 
 // #define VERBOSE
 
 namespace vox {
+ChunkBuffer::ChunkBuffer(FILE* vFile) {
+    file = vFile;
+    if (file) {
+        bytes.reserve(flushSize);
+    }
+}
+
+void ChunkBuffer::Put(const void* vData, const size_t& vSize) {
+    if (file && bytes.size() + vSize > flushSize) {
+        Flush();
+        if (vSize >= flushSize) {
+            // big enough for a write of its own
+            fwrite(vData, sizeof(uint8_t), vSize, file);
+            return;
+        }
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(vData);
+    bytes.insert(bytes.end(), data, data + vSize);
+}
+
+void ChunkBuffer::Flush() {
+    if (file && !bytes.empty()) {
+        fwrite(bytes.data(), sizeof(uint8_t), bytes.size(), file);
+        bytes.clear();
+    }
+}
+
+//////////////////////////////////////////////////////////////////
+
 DICTstring::DICTstring() { bufferSize = 0; }
 
-void DICTstring::write(FILE* fp) {
+void DICTstring::write(ChunkBuffer& vBuffer) {
     bufferSize = (int32_t)buffer.size();
-    fwrite(&bufferSize, sizeof(int32_t), 1, fp);
-    fwrite(buffer.data(), sizeof(char), bufferSize, fp);
+    vBuffer.PutInt(bufferSize);
+    vBuffer.Put(buffer.data(), sizeof(char) * bufferSize);
 }
 
 size_t DICTstring::getSize() {
@@ -57,33 +94,33 @@ DICTitem::DICTitem(std::string vKey, std::string vValue) {
     value.buffer = vValue;
 }
 
-void DICTitem::write(FILE* fp) {
-    key.write(fp);
-    value.write(fp);
+void DICTitem::write(ChunkBuffer& vBuffer) {
+    key.write(vBuffer);
+    value.write(vBuffer);
 }
 
 size_t DICTitem::getSize() { return key.getSize() + value.getSize(); }
 
 //////////////////////////////////////////////////////////////////
 
-DICT::DICT() { count = 0; }
+DICT::DICT() {
+    count = 0;
+    size  = sizeof(int32_t);
+}
 
-void DICT::write(FILE* fp) {
+void DICT::write(ChunkBuffer& vBuffer) {
     count = (int32_t)keys.size();
-    fwrite(&count, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(count);
     for (int i = 0; i < count; i++)
-        keys[i].write(fp);
+        keys[i].write(vBuffer);
 }
 
-size_t DICT::getSize() {
-    count    = (int32_t)keys.size();
-    size_t s = sizeof(int32_t);
-    for (int i = 0; i < count; i++)
-        s += keys[i].getSize();
-    return s;
-}
+size_t DICT::getSize() { return size; }
 
-void DICT::Add(std::string vKey, std::string vValue) { keys.push_back(DICTitem(vKey, vValue)); }
+void DICT::Add(std::string vKey, std::string vValue) {
+    keys.push_back(DICTitem(vKey, vValue));
+    size += keys.back().getSize();
+}
 
 //////////////////////////////////////////////////////////////////
 
@@ -98,24 +135,24 @@ nTRN::nTRN(int32_t countFrames) {
         frames.push_back(DICT());
 }
 
-void nTRN::write(FILE* fp) {
+void nTRN::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('n', 'T', 'R', 'N');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&nodeId, sizeof(int32_t), 1, fp);
-    nodeAttribs.write(fp);
-    fwrite(&childNodeId, sizeof(int32_t), 1, fp);
-    fwrite(&reservedId, sizeof(int32_t), 1, fp);
-    fwrite(&layerId, sizeof(int32_t), 1, fp);
-    fwrite(&numFrames, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(nodeId);
+    nodeAttribs.write(vBuffer);
+    vBuffer.PutInt(childNodeId);
+    vBuffer.PutInt(reservedId);
+    vBuffer.PutInt(layerId);
+    vBuffer.PutInt(numFrames);
     for (int i = 0; i < numFrames; i++)
-        frames[i].write(fp);
+        frames[i].write(vBuffer);
 }
 
 size_t nTRN::getSize() {
@@ -134,20 +171,20 @@ nGRP::nGRP(int32_t vCount) {
         childNodes.push_back(0);
 }
 
-void nGRP::write(FILE* fp) {
+void nGRP::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('n', 'G', 'R', 'P');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&nodeId, sizeof(int32_t), 1, fp);
-    nodeAttribs.write(fp);
-    fwrite(&nodeChildrenNodes, sizeof(int32_t), 1, fp);
-    fwrite(childNodes.data(), sizeof(int32_t), nodeChildrenNodes, fp);
+    vBuffer.PutInt(nodeId);
+    nodeAttribs.write(vBuffer);
+    vBuffer.PutInt(nodeChildrenNodes);
+    vBuffer.Put(childNodes.data(), sizeof(int32_t) * nodeChildrenNodes);
 }
 
 size_t nGRP::getSize() { return sizeof(int32_t) * (2 + nodeChildrenNodes) + nodeAttribs.getSize(); }
@@ -156,9 +193,9 @@ size_t nGRP::getSize() { return sizeof(int32_t) * (2 + nodeChildrenNodes) + node
 
 MODEL::MODEL() { modelId = 0; }
 
-void MODEL::write(FILE* fp) {
-    fwrite(&modelId, sizeof(int32_t), 1, fp);
-    modelAttribs.write(fp);
+void MODEL::write(ChunkBuffer& vBuffer) {
+    vBuffer.PutInt(modelId);
+    modelAttribs.write(vBuffer);
 }
 
 size_t MODEL::getSize() { return sizeof(int32_t) + modelAttribs.getSize(); }
@@ -171,21 +208,21 @@ nSHP::nSHP(int32_t vCount) {
     models.resize(numModels);
 }
 
-void nSHP::write(FILE* fp) {
+void nSHP::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('n', 'S', 'H', 'P');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&nodeId, sizeof(int32_t), 1, fp);
-    nodeAttribs.write(fp);
-    fwrite(&numModels, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(nodeId);
+    nodeAttribs.write(vBuffer);
+    vBuffer.PutInt(numModels);
     for (int i = 0; i < numModels; i++)
-        models[i].write(fp);
+        models[i].write(vBuffer);
 }
 
 size_t nSHP::getSize() {
@@ -202,19 +239,19 @@ LAYR::LAYR() {
     reservedId = -1;
 }
 
-void LAYR::write(FILE* fp) {
+void LAYR::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('L', 'A', 'Y', 'R');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&nodeId, sizeof(int32_t), 1, fp);
-    nodeAttribs.write(fp);
-    fwrite(&reservedId, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(nodeId);
+    nodeAttribs.write(vBuffer);
+    vBuffer.PutInt(reservedId);
 }
 
 size_t LAYR::getSize() { return sizeof(int32_t) * 2 + nodeAttribs.getSize(); }
@@ -227,19 +264,19 @@ SIZE::SIZE() {
     sizez = 0;
 }
 
-void SIZE::write(FILE* fp) {
+void SIZE::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('S', 'I', 'Z', 'E');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&sizex, sizeof(int32_t), 1, fp);
-    fwrite(&sizey, sizeof(int32_t), 1, fp);
-    fwrite(&sizez, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(sizex);
+    vBuffer.PutInt(sizey);
+    vBuffer.PutInt(sizez);
 }
 
 size_t SIZE::getSize() { return sizeof(int32_t) * 3; }
@@ -248,18 +285,18 @@ size_t SIZE::getSize() { return sizeof(int32_t) * 3; }
 
 XYZI::XYZI() { numVoxels = 0; }
 
-void XYZI::write(FILE* fp) {
+void XYZI::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('X', 'Y', 'Z', 'I');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(&numVoxels, sizeof(int32_t), 1, fp);
-    fwrite(voxels.data(), sizeof(uint8_t), voxels.size(), fp);
+    vBuffer.PutInt(numVoxels);
+    vBuffer.Put(voxels.data(), sizeof(uint8_t) * voxels.size());
 }
 
 size_t XYZI::getSize() {
@@ -271,17 +308,17 @@ size_t XYZI::getSize() {
 
 RGBA::RGBA() {}
 
-void RGBA::write(FILE* fp) {
+void RGBA::write(ChunkBuffer& vBuffer) {
     // chunk header
     int32_t id = GetMVID('R', 'G', 'B', 'A');
-    fwrite(&id, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt(id);
     size_t contentSize = getSize();
-    fwrite(&contentSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)contentSize);
     size_t childSize = 0;
-    fwrite(&childSize, sizeof(int32_t), 1, fp);
+    vBuffer.PutInt((int32_t)childSize);
 
     // datas's
-    fwrite(colors, sizeof(uint8_t), contentSize, fp);
+    vBuffer.Put(colors, sizeof(uint8_t) * contentSize);
 }
 
 size_t RGBA::getSize() { return sizeof(uint8_t) * 4 * 256; }
@@ -295,10 +332,10 @@ VoxCube::VoxCube() {
     tz = 0;
 }
 
-void VoxCube::write(FILE* fp) {
+void VoxCube::write(ChunkBuffer& vBuffer) {
     for (auto& xyzi : xyzis) {
-        size.write(fp);
-        xyzi.second.write(fp);
+        size.write(vBuffer);
+        xyzi.second.write(vBuffer);
     }
 }
 
@@ -392,8 +429,18 @@ int32_t VoxWriter::IsOk(const std::string& vFilePathName) {
 
 void VoxWriter::ClearVoxels() {
     cubes.clear();
-    cubesId.clear();
-    voxelId.clear();
+    m_CubeIds.clear();
+    m_CubesCountX = 0;
+    m_CubesCountY = 0;
+    m_CubesCountZ = 0;
+    maxCubeId     = 0;
+    m_MinVoxelX   = SIZE_MAX;
+    m_MinVoxelY   = SIZE_MAX;
+    m_MinVoxelZ   = SIZE_MAX;
+    m_MaxVoxelX   = 0;
+    m_MaxVoxelY   = 0;
+    m_MaxVoxelZ   = 0;
+    m_LastCubeId  = SIZE_MAX;
 }
 
 void VoxWriter::ClearColors() { colors.clear(); }
@@ -442,122 +489,255 @@ void VoxWriter::AddColor(const uint8_t& r, const uint8_t& g, const uint8_t& b, c
 }
 
 void VoxWriter::AddVoxel(const size_t& vX, const size_t& vY, const size_t& vZ, const uint8_t& vColorIndex) {
-    // cube pos
-    size_t  ox = (size_t)std::floor((double)vX / (double)m_MaxVoxelPerCubeX);
-    size_t oy = (size_t)std::floor((double)vY / (double)m_MaxVoxelPerCubeY);
-    size_t  oz = (size_t)std::floor((double)vZ / (double)m_MaxVoxelPerCubeZ);
+    // cube pos, positions are unsigned so the integer division is the floor
+    size_t ox = vX / m_MaxVoxelPerCubeX;
+    size_t oy = vY / m_MaxVoxelPerCubeY;
+    size_t oz = vZ / m_MaxVoxelPerCubeZ;
 
     minCubeX = ct::mini<size_t>(minCubeX, ox);
     minCubeY = ct::mini<size_t>(minCubeX, oy);
     minCubeZ = ct::mini<size_t>(minCubeX, oz);
 
+    m_MinVoxelX = std::min(m_MinVoxelX, vX);
+    m_MinVoxelY = std::min(m_MinVoxelY, vY);
+    m_MinVoxelZ = std::min(m_MinVoxelZ, vZ);
+    m_MaxVoxelX = std::max(m_MaxVoxelX, vX);
+    m_MaxVoxelY = std::max(m_MaxVoxelY, vY);
+    m_MaxVoxelZ = std::max(m_MaxVoxelZ, vZ);
+
     auto cube = m_GetCube(ox, oy, oz);
 
-    m_MergeVoxelInCube(vX, vY, vZ, vColorIndex, cube);
+    m_MergeVoxelInCube(vX - ox * m_MaxVoxelPerCubeX, vY - oy * m_MaxVoxelPerCubeY, vZ - oz * m_MaxVoxelPerCubeZ, vColorIndex, cube);
 }
 
-void VoxWriter::SaveToFile(const std::string& vFilePathName) {
-    if (m_OpenFileForWriting(vFilePathName)) {
-        int32_t zero = 0;
+void VoxWriter::AddColumn(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZBegin, const VoxelZ& vZEnd, const uint8_t& vColorIndex) {
+    if (vZBegin >= vZEnd) {
+        return;
+    }
 
-        fwrite(&ID_VOX, sizeof(int32_t), 1, m_File);
-        fwrite(&MV_VERSION, sizeof(int32_t), 1, m_File);
+    size_t ox     = vX / m_MaxVoxelPerCubeX;
+    size_t oy     = vY / m_MaxVoxelPerCubeY;
+    size_t lastOz = (vZEnd - 1) / m_MaxVoxelPerCubeZ;
 
-        // MAIN CHUNCK
-        fwrite(&ID_MAIN, sizeof(int32_t), 1, m_File);
-        fwrite(&zero, sizeof(int32_t), 1, m_File);
+    // as AddVoxel leaves them after the last voxel of the column
+    minCubeX = ct::mini<size_t>(minCubeX, ox);
+    minCubeY = ct::mini<size_t>(minCubeX, oy);
+    minCubeZ = ct::mini<size_t>(minCubeX, lastOz);
+
+    m_MinVoxelX = std::min(m_MinVoxelX, vX);
+    m_MinVoxelY = std::min(m_MinVoxelY, vY);
+    m_MinVoxelZ = std::min(m_MinVoxelZ, vZBegin);
+    m_MaxVoxelX = std::max(m_MaxVoxelX, vX);
+    m_MaxVoxelY = std::max(m_MaxVoxelY, vY);
+    m_MaxVoxelZ = std::max(m_MaxVoxelZ, vZEnd - 1);
+
+    // cubes from the bottom, in the order AddVoxel makes them
+    for (size_t oz = vZBegin / m_MaxVoxelPerCubeZ; oz * m_MaxVoxelPerCubeZ < vZEnd; oz++) {
+        const VoxelZ cubeZ = oz * m_MaxVoxelPerCubeZ;
+        auto         cube  = m_GetCube(ox, oy, oz);
+        m_MergeColumnInCube(vX - ox * m_MaxVoxelPerCubeX, vY - oy * m_MaxVoxelPerCubeY, std::max(vZBegin, cubeZ) - cubeZ, std::min(vZEnd, cubeZ + m_MaxVoxelPerCubeZ) - cubeZ, vColorIndex, cube);
+    }
+}
 
-        long numBytesMainChunkPos = m_GetFilePos();
-        fwrite(&zero, sizeof(int32_t), 1, m_File);
+void VoxWriter::AddHeightField(const HeightFieldView& vView) {
+    for (size_t x = 0; x < vView.sizeX; ++x) {
+        const int32_t* heights = vView.heights + x * vView.sizeY;
+        const uint8_t* colors  = vView.colors + x * vView.sizeY;
+        const int32_t* bottoms = vView.bottoms ? vView.bottoms + x * vView.sizeY : nullptr;
+        for (size_t y = 0; y < vView.sizeY; ++y) {
+            const int32_t bottom = bottoms ? std::max(0, bottoms[y]) : 0;
+            if (heights[y] > bottom) {
+                AddColumn(x, y, (VoxelZ)bottom, (VoxelZ)heights[y], colors[y]);
+            }
+        }
+    }
+}
 
-        long headerSize = m_GetFilePos();
+std::vector<int32_t> GetShellBottoms(const HeightFieldView& vView) {
+    const size_t         sizeY = vView.sizeY;
+    std::vector<int32_t> bottoms(vView.sizeX * sizeY);
+    const std::vector<int32_t> outside(sizeY, 0);
+    // plain loops over rows, without branches they are vectorized
+    for (size_t x = 0; x < vView.sizeX; ++x) {
+        const int32_t* row   = vView.heights + x * sizeY;
+        const int32_t* prev  = x > 0 ? row - sizeY : outside.data();
+        const int32_t* next  = x + 1 < vView.sizeX ? row + sizeY : outside.data();
+        int32_t*       out   = bottoms.data() + x * sizeY;
+        for (size_t y = 0; y < sizeY; ++y) {
+            out[y] = std::min(prev[y], next[y]);
+        }
+        for (size_t y = 1; y + 1 < sizeY; ++y) {
+            out[y] = std::min(out[y], std::min(row[y - 1], row[y + 1]));
+        }
+        if (sizeY > 0) {
+            out[0]         = 0;
+            out[sizeY - 1] = 0;
+        }
+        for (size_t y = 0; y < sizeY; ++y) {
+            out[y] = std::max(0, std::min(out[y], row[y] - 1));
+        }
+    }
+    return bottoms;
+}
 
-        int count = (int)cubes.size();
+void VoxWriter::SetDeduplication(const bool& vEnabled) { m_Deduplication = vEnabled; }
 
-        int  nodeIds = 0;
-        nTRN rootTransform(1);
-        rootTransform.nodeId      = nodeIds;
-        rootTransform.childNodeId = ++nodeIds;
+void VoxWriter::SetThreadsCount(const size_t& vCount) { m_ThreadsCount = std::max<size_t>(1, vCount); }
 
-        nGRP rootGroup(count);
-        rootGroup.nodeId            = nodeIds;  //
-        rootGroup.nodeChildrenNodes = count;
+void VoxWriter::SaveToFile(const std::string& vFilePathName) {
+    if (m_OpenFileForWriting(vFilePathName)) {
+        ChunkBuffer buffer(m_File);
+        int64_t     numBytesMainChunkPos = 0;
+        int64_t     headerSize           = 0;
+        m_WriteHeader(buffer, numBytesMainChunkPos, headerSize);
 
-        std::vector<nSHP> shapes;
-        std::vector<nTRN> shapeTransforms;
-        size_t            cube_idx = 0U;
-        int32_t           model_id = 0U;
+        std::vector<CubeNode> nodes;
+        nodes.reserve(cubes.size());
         for (auto& cube : cubes) {
-            cube.write(m_File);
-
-            // trans
-            nTRN trans(1);// not a trans anim so ony one frame
-            trans.nodeId                   = ++nodeIds;  //
-            rootGroup.childNodes[cube_idx] = nodeIds;
-            trans.childNodeId              = ++nodeIds;
-            trans.layerId                  = 0;
-            cube.tx = (int)std::floor((cube.tx - minCubeX + 0.5f) * m_MaxVoxelPerCubeX - maxVolume.lowerBound.x - maxVolume.Size().x * 0.5);
-            cube.ty = (int)std::floor((cube.ty - minCubeY + 0.5f) * m_MaxVoxelPerCubeY - maxVolume.lowerBound.y - maxVolume.Size().y * 0.5);
-            cube.tz = (int)std::floor((cube.tz - minCubeZ + 0.5f) * m_MaxVoxelPerCubeZ);
-            trans.frames[0].Add("_t", ct::toStr(cube.tx) + " " + ct::toStr(cube.ty) + " " + ct::toStr(cube.tz));
-            shapeTransforms.push_back(trans);
+            cube.write(buffer);
 
-            // shape
-            nSHP shape((int32_t)cube.xyzis.size());
-            shape.nodeId            = nodeIds;
-            size_t model_array_id = 0U;
+            CubeNode node;
+            node.tx = cube.tx;
+            node.ty = cube.ty;
+            node.tz = cube.tz;
             for (const auto& xyzi : cube.xyzis) {
-                shape.models[model_array_id].modelId = model_id;
-                shape.models[model_array_id].modelAttribs.Add("_f", ct::toStr(xyzi.first));
-                ++model_array_id;
-                ++model_id;
+                node.keyFrames.push_back(xyzi.first);
             }
-            shapes.push_back(shape);
-
-            ++cube_idx;
+            nodes.push_back(node);
         }
 
-        rootTransform.write(m_File);
-        rootGroup.write(m_File);
+        m_WriteSceneGraph(buffer, nodes, m_GetVolume(), minCubeX, minCubeY, minCubeZ);
+        m_WriteFooter(buffer, numBytesMainChunkPos, headerSize);
 
-        // trn & shp
-        for (int i = 0; i < count; i++) {
-            shapeTransforms[i].write(m_File);
-            shapes[i].write(m_File);
-        }
+        m_CloseFile();
+    }
+}
 
-        // no layr in my cases
-
-        // layr
-        /*for (int i = 0; i < 8; i++)
-        {
-            LAYR layr;
-            layr.nodeId = i;
-            layr.nodeAttribs.Add("_name", ct::toStr(i));
-            layr.write(m_File);
-        }*/
-
-        // RGBA Palette
-        if (colors.size() > 0) {
-            RGBA palette;
-            for (int32_t i = 0; i < 255; i++) {
-                if (i < (int32_t)colors.size()) {
-                    palette.colors[i] = colors[i];
-                } else {
-                    palette.colors[i] = 0;
+void VoxWriter::SaveHeightFieldToFile(const HeightFieldView& vView, const std::string& vFilePathName, const HeightFieldFrame* vFrame) {
+    // first pass, over the columns only: the cubes in the order
+    // AddHeightField makes them, their voxel counts and the bounds
+    const size_t cubesX    = (vView.sizeX + m_MaxVoxelPerCubeX - 1) / m_MaxVoxelPerCubeX;
+    const size_t cubesY    = (vView.sizeY + m_MaxVoxelPerCubeY - 1) / m_MaxVoxelPerCubeY;
+    int32_t      maxHeight = 0;
+    for (size_t i = 0; i < vView.sizeX * vView.sizeY; ++i) {
+        maxHeight = std::max(maxHeight, vView.heights[i]);
+    }
+    const size_t cubesZ = ((size_t)maxHeight + m_MaxVoxelPerCubeZ - 1) / m_MaxVoxelPerCubeZ;
+
+    std::vector<CubeID>   cubeIds(cubesX * cubesY * cubesZ, 0);
+    std::vector<CubeNode> nodes;
+    std::vector<size_t>   voxelsCounts;
+    HeightFieldFrame      frame;
+    for (size_t x = 0; x < vView.sizeX; ++x) {
+        for (size_t y = 0; y < vView.sizeY; ++y) {
+            const size_t  i      = x * vView.sizeY + y;
+            const int32_t bottom = vView.bottoms ? std::max(0, vView.bottoms[i]) : 0;
+            const int32_t height = vView.heights[i];
+            if (height <= bottom) {
+                continue;
+            }
+            size_t ox     = x / m_MaxVoxelPerCubeX;
+            size_t oy     = y / m_MaxVoxelPerCubeY;
+            size_t lastOz = (height - 1) / m_MaxVoxelPerCubeZ;
+            m_AddColumnToFrame(frame, x, y, bottom, height);
+
+            for (size_t oz = bottom / m_MaxVoxelPerCubeZ; oz <= lastOz; oz++) {
+                auto& id = cubeIds[(oz * cubesY + oy) * cubesX + ox];
+                if (id == 0) {
+                    CubeNode node;
+                    node.tx = (int32_t)ox;
+                    node.ty = (int32_t)oy;
+                    node.tz = (int32_t)oz;
+                    node.keyFrames.push_back(m_KeyFrame);
+                    nodes.push_back(node);
+                    voxelsCounts.push_back(0);
+                    id = nodes.size();
                 }
+                const int32_t cubeZ = (int32_t)(oz * m_MaxVoxelPerCubeZ);
+                voxelsCounts[id - 1] += std::min(height, cubeZ + (int32_t)m_MaxVoxelPerCubeZ) - std::max(bottom, cubeZ);
             }
+        }
+    }
 
-            palette.write(m_File);
+    if (!m_OpenFileForWriting(vFilePathName)) {
+        return;
+    }
+    ChunkBuffer buffer(m_File);
+    int64_t     numBytesMainChunkPos = 0;
+    int64_t     headerSize           = 0;
+    m_WriteHeader(buffer, numBytesMainChunkPos, headerSize);
+
+    // second pass: the chunk sizes are known, so the offsets are a prefix
+    // sum and the cubes are encoded in parallel, runs of cubes of about
+    // m_WriteBlockSize bytes are written at their place in the file
+    std::vector<int64_t> offsets(nodes.size() + 1);
+    offsets[0] = headerSize;
+    for (size_t c = 0; c < nodes.size(); c++) {
+        offsets[c + 1] = offsets[c] + (int64_t)(sizeof(int32_t) * (3 + 3 + 3 + 1) + 4 * voxelsCounts[c]);
+    }
+    std::vector<size_t> runs(1, 0);
+    for (size_t c = 1; c <= nodes.size(); c++) {
+        if (c == nodes.size() || offsets[c] - offsets[runs.back()] >= (int64_t)m_WriteBlockSize) {
+            runs.push_back(c);
         }
+    }
+    buffer.Flush();
+    fflush(m_File);
+    std::vector<std::vector<uint8_t>> cubesBytes(m_ThreadsCount);
+    m_RunInParallel(runs.size() - 1, [&](size_t vRun, size_t vThread) {
+        auto& bytes = cubesBytes[vThread];
+        bytes.resize(offsets[runs[vRun + 1]] - offsets[runs[vRun]]);
+        for (size_t c = runs[vRun]; c < runs[vRun + 1]; c++) {
+            m_EncodeHeightFieldCube(vView, nodes[c], voxelsCounts[c], bytes.data() + (offsets[c] - offsets[runs[vRun]]));
+        }
+        m_WriteAt(bytes.data(), bytes.size(), offsets[runs[vRun]]);
+    });
+    m_SetFilePos(offsets.back());
 
-        const long mainChildChunkSize = m_GetFilePos() - headerSize;
-        m_SetFilePos(numBytesMainChunkPos);
-        uint32_t size = (uint32_t)mainChildChunkSize;
-        fwrite(&size, sizeof(uint32_t), 1, m_File);
+    if (vFrame) {
+        frame = *vFrame;
+    }
+    Volume volume(1e7, -1e7);
+    if (frame.minX <= frame.maxX) {
+        volume = Volume(ct::dvec3((double)frame.minX, (double)frame.minY, (double)frame.minZ), ct::dvec3((double)frame.maxX, (double)frame.maxY, (double)frame.maxZ));
+    }
+    m_WriteSceneGraph(buffer, nodes, volume, frame.minCubeX, frame.minCubeY, frame.minCubeZ, frame.originX, frame.originY);
+    m_WriteFooter(buffer, numBytesMainChunkPos, headerSize);
 
-        m_CloseFile();
+    m_CloseFile();
+}
+
+HeightFieldFrame VoxWriter::GetHeightFieldFrame(const HeightFieldView& vView) const {
+    HeightFieldFrame frame;
+    for (size_t x = 0; x < vView.sizeX; ++x) {
+        for (size_t y = 0; y < vView.sizeY; ++y) {
+            const size_t  i      = x * vView.sizeY + y;
+            const int32_t bottom = vView.bottoms ? std::max(0, vView.bottoms[i]) : 0;
+            const int32_t height = vView.heights[i];
+            if (height > bottom) {
+                m_AddColumnToFrame(frame, x, y, bottom, height);
+            }
+        }
     }
+    return frame;
+}
+
+void VoxWriter::m_AddColumnToFrame(HeightFieldFrame& vFrame, const VoxelX& vX, const VoxelY& vY, const int32_t& vBottom, const int32_t& vHeight) const {
+    size_t ox     = vX / m_MaxVoxelPerCubeX;
+    size_t oy     = vY / m_MaxVoxelPerCubeY;
+    size_t lastOz = (vHeight - 1) / m_MaxVoxelPerCubeZ;
+
+    // the same quirk as AddColumn
+    vFrame.minCubeX = ct::mini<size_t>(vFrame.minCubeX, ox);
+    vFrame.minCubeY = ct::mini<size_t>(vFrame.minCubeX, oy);
+    vFrame.minCubeZ = ct::mini<size_t>(vFrame.minCubeX, lastOz);
+
+    vFrame.minX = std::min(vFrame.minX, vX);
+    vFrame.minY = std::min(vFrame.minY, vY);
+    vFrame.minZ = std::min(vFrame.minZ, (VoxelZ)vBottom);
+    vFrame.maxX = std::max(vFrame.maxX, vX);
+    vFrame.maxY = std::max(vFrame.maxY, vY);
+    vFrame.maxZ = std::max(vFrame.maxZ, (VoxelZ)vHeight - 1);
 }
 
 const size_t VoxWriter::GetVoxelsCount(const KeyFrame& vKeyFrame) const {
@@ -582,6 +762,7 @@ const size_t VoxWriter::GetVoxelsCount() const {
 
 void VoxWriter::PrintStats() const {
     std::cout << "---- Stats ------------------------------" << std::endl;
+    const Volume maxVolume = m_GetVolume();
     std::cout << "Volume : " << maxVolume.Size().x << " x " << maxVolume.Size().y << " x " << maxVolume.Size().z << std::endl;
     std::cout << "count cubes : " << cubes.size() << std::endl;
     std::map<KeyFrame, size_t> frame_counts;
@@ -625,69 +806,354 @@ bool VoxWriter::m_OpenFileForWriting(const std::string& vFilePathName) {
 
 void VoxWriter::m_CloseFile() { fclose(m_File); }
 
-long VoxWriter::m_GetFilePos() const { return ftell(m_File); }
+// long is 32 bits on Windows, the offsets are 64 bits everywhere
+int64_t VoxWriter::m_GetFilePos() const {
+#if _MSC_VER
+    return _ftelli64(m_File);
+#else
+    return ftello(m_File);
+#endif
+}
 
-void VoxWriter::m_SetFilePos(const long& vPos) {
+void VoxWriter::m_SetFilePos(const int64_t& vPos) {
     //  SEEK_SET	Beginning of file
     //  SEEK_CUR	Current position of the file pointer
     //	SEEK_END	End of file
-    fseek(m_File, vPos, SEEK_SET);
+#if _MSC_VER
+    _fseeki64(m_File, vPos, SEEK_SET);
+#else
+    fseeko(m_File, (off_t)vPos, SEEK_SET);
+#endif
 }
 
-const size_t VoxWriter::m_GetCubeId(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ) {
-    if (cubesId.find(vX) != cubesId.end()) {
-        if (cubesId[vX].find(vY) != cubesId[vX].end()) {
-            if (cubesId[vX][vY].find(vZ) != cubesId[vX][vY].end()) {
-                return cubesId[vX][vY][vZ];
+void VoxWriter::m_WriteAt(const uint8_t* vData, const size_t& vSize, const int64_t& vPos) {
+    auto setError = [this](int32_t vError) {
+        int32_t none = 0;
+        lastError.compare_exchange_strong(none, vError);
+    };
+#if _MSC_VER
+    // no pwrite, the writes are serialized on the stream
+    std::lock_guard<std::mutex> lock(m_WriteMutex);
+    _fseeki64(m_File, vPos, SEEK_SET);
+    if (fwrite(vData, sizeof(uint8_t), vSize, m_File) != vSize) {
+        setError(errno);
+    }
+#else
+    const int fd   = fileno(m_File);
+    size_t    done = 0;
+    while (done < vSize) {
+        const ssize_t res = pwrite(fd, vData + done, vSize - done, (off_t)vPos + (off_t)done);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            setError(errno);
+            return;
+        }
+        done += (size_t)res;
+    }
+#endif
+}
+
+void VoxWriter::m_RunInParallel(const size_t& vTasksCount, const std::function<void(size_t, size_t)>& vTask) const {
+    const size_t             threadsCount = std::max<size_t>(1, std::min(m_ThreadsCount, vTasksCount));
+    std::atomic<size_t>      next(0);
+    std::vector<std::thread> threads;
+    auto                     worker = [&](size_t vThread) {
+        for (size_t task = next++; task < vTasksCount; task = next++) {
+            vTask(task, vThread);
         }
+    };
+    for (size_t t = 1; t < threadsCount; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
     }
+}
+
+void VoxWriter::m_WriteHeader(ChunkBuffer& vBuffer, int64_t& vNumBytesMainChunkPos, int64_t& vHeaderSize) {
+    int32_t zero = 0;
+
+    vBuffer.PutInt(ID_VOX);
+    vBuffer.PutInt(MV_VERSION);
 
-    cubesId[vX][vY][vZ] = maxCubeId++;
+    // MAIN CHUNCK
+    vBuffer.PutInt(ID_MAIN);
+    vBuffer.PutInt(zero);
 
-    return cubesId[vX][vY][vZ];
+    vNumBytesMainChunkPos = m_GetFilePos() + (int64_t)vBuffer.bytes.size();
+    vBuffer.PutInt(zero);
+
+    vHeaderSize = m_GetFilePos() + (int64_t)vBuffer.bytes.size();
 }
 
-// Wrap a position inside a particular cube dimension
-inline uint8_t Wrap(size_t v, size_t lim) {
-    v = v % lim;
-    if (v < 0) {
-        v += lim;
+void VoxWriter::m_WriteSceneGraph(ChunkBuffer& vBuffer, const std::vector<CubeNode>& vNodes, const Volume& vVolume, const CubeX& vMinCubeX, const CubeY& vMinCubeY, const CubeZ& vMinCubeZ, const VoxelX& vOriginX, const VoxelY& vOriginY) {
+    int count = (int)vNodes.size();
+
+    int  nodeIds = 0;
+    nTRN rootTransform(1);
+    rootTransform.nodeId      = nodeIds;
+    rootTransform.childNodeId = ++nodeIds;
+
+    nGRP rootGroup(count);
+    rootGroup.nodeId            = nodeIds;  //
+    rootGroup.nodeChildrenNodes = count;
+
+    // ids of the trans and of the models only depend on the cube index
+    // and on the key frames before, the chunks are made in parallel
+    std::vector<int32_t> modelIds(count + 1, 0);
+    for (int i = 0; i < count; i++) {
+        rootGroup.childNodes[i] = nodeIds + 1 + 2 * i;
+        modelIds[i + 1]         = modelIds[i] + (int32_t)vNodes[i].keyFrames.size();
     }
-    return (uint8_t)v;
+
+    rootTransform.write(vBuffer);
+    rootGroup.write(vBuffer);
+
+    // trn & shp, runs of cubes encoded in memory, then written
+    // at the offsets of the prefix sum of their sizes
+    const size_t                      runSize = 256;
+    const size_t                      runs    = (vNodes.size() + runSize - 1) / runSize;
+    std::vector<std::vector<uint8_t>> chunks(runs);
+    m_RunInParallel(runs, [&](size_t vRun, size_t /*vThread*/) {
+        ChunkBuffer run;
+        for (size_t cube_idx = vRun * runSize; cube_idx < std::min(vNodes.size(), (vRun + 1) * runSize); cube_idx++) {
+            const auto& cube = vNodes[cube_idx];
+
+            // trans
+            nTRN trans(1);// not a trans anim so ony one frame
+            trans.nodeId      = rootGroup.childNodes[cube_idx];
+            trans.childNodeId = trans.nodeId + 1;
+            trans.layerId     = 0;
+            // in doubles, the cube of a view with an origin can be before the first cube of the frame
+            const double x  = (double)vOriginX + ((double)cube.tx - (double)vMinCubeX + 0.5) * m_MaxVoxelPerCubeX;
+            const double y  = (double)vOriginY + ((double)cube.ty - (double)vMinCubeY + 0.5) * m_MaxVoxelPerCubeY;
+            const int    tx = (int)std::floor(x - vVolume.lowerBound.x - vVolume.Size().x * 0.5);
+            const int    ty = (int)std::floor(y - vVolume.lowerBound.y - vVolume.Size().y * 0.5);
+            const int tz = (int)std::floor((cube.tz - vMinCubeZ + 0.5f) * m_MaxVoxelPerCubeZ);
+            trans.frames[0].Add("_t", ct::toStr(tx) + " " + ct::toStr(ty) + " " + ct::toStr(tz));
+            trans.write(run);
+
+            // shape
+            nSHP shape((int32_t)cube.keyFrames.size());
+            shape.nodeId            = trans.childNodeId;
+            size_t  model_array_id = 0U;
+            int32_t model_id       = modelIds[cube_idx];
+            for (const auto& keyFrame : cube.keyFrames) {
+                shape.models[model_array_id].modelId = model_id;
+                shape.models[model_array_id].modelAttribs.Add("_f", ct::toStr(keyFrame));
+                ++model_array_id;
+                ++model_id;
+            }
+            shape.write(run);
+        }
+        chunks[vRun] = std::move(run.bytes);
+    });
+
+    vBuffer.Flush();
+    fflush(m_File);
+    std::vector<int64_t> offsets(runs + 1);
+    offsets[0] = m_GetFilePos();
+    for (size_t i = 0; i < runs; i++) {
+        offsets[i + 1] = offsets[i] + (int64_t)chunks[i].size();
+    }
+    m_RunInParallel(runs, [&](size_t vRun, size_t /*vThread*/) { m_WriteAt(chunks[vRun].data(), chunks[vRun].size(), offsets[vRun]); });
+    m_SetFilePos(offsets.back());
+
+    // no layr in my cases
+
+    // layr
+    /*for (int i = 0; i < 8; i++)
+    {
+        LAYR layr;
+        layr.nodeId = i;
+        layr.nodeAttribs.Add("_name", ct::toStr(i));
+        layr.write(vBuffer);
+    }*/
 }
 
-void VoxWriter::m_MergeVoxelInCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ, const uint8_t& vColorIndex, VoxCube* vCube) {
-    maxVolume.Combine(ct::dvec3((double)vX, (double)vY, (double)vZ));
-
-    bool exist = false;
-    if (voxelId.find(m_KeyFrame) != voxelId.end()) {
-        auto& vidk = voxelId.at(m_KeyFrame);
-        if (vidk.find(vX) != vidk.end()) {
-            auto& vidkx = vidk.at(vX);
-            if (vidkx.find(vY) != vidkx.end()) {
-                auto& vidkxy = vidkx.at(vY);
-                if (vidkxy.find(vZ) != vidkxy.end()) {
-                    exist = true;
-                }
+void VoxWriter::m_WriteFooter(ChunkBuffer& vBuffer, const int64_t& vNumBytesMainChunkPos, const int64_t& vHeaderSize) {
+    // RGBA Palette
+    if (colors.size() > 0) {
+        RGBA palette;
+        for (int32_t i = 0; i < 255; i++) {
+            if (i < (int32_t)colors.size()) {
+                palette.colors[i] = colors[i];
+            } else {
+                palette.colors[i] = 0;
+            }
+        }
+
+        palette.write(vBuffer);
+    }
+    vBuffer.Flush();
+
+    const int64_t mainChildChunkSize = m_GetFilePos() - vHeaderSize;
+    m_SetFilePos(vNumBytesMainChunkPos);
+    uint32_t size = (uint32_t)mainChildChunkSize;
+    fwrite(&size, sizeof(uint32_t), 1, m_File);
+}
+
+void VoxWriter::m_EncodeHeightFieldCube(const HeightFieldView& vView, const CubeNode& vNode, const size_t& vVoxelsCount, uint8_t* vOut) const {
+    // SIZE and XYZI chunks, the same bytes as VoxCube::write
+    uint8_t* out = vOut;
+    auto     put = [&out](const int32_t& v) {
+        memcpy(out, &v, sizeof(int32_t));
+        out += sizeof(int32_t);
+    };
+    put(ID_SIZE);
+    put(sizeof(int32_t) * 3);
+    put(0);
+    put((int32_t)m_MaxVoxelPerCubeX);
+    put((int32_t)m_MaxVoxelPerCubeY);
+    put((int32_t)m_MaxVoxelPerCubeZ);
+    put(ID_XYZI);
+    put((int32_t)(sizeof(int32_t) * (1 + vVoxelsCount)));
+    put(0);
+    put((int32_t)vVoxelsCount);
+
+    // columns x then y, z from the bottom, as AddHeightField appends them
+    const size_t  x0 = (size_t)vNode.tx * m_MaxVoxelPerCubeX;
+    const size_t  y0 = (size_t)vNode.ty * m_MaxVoxelPerCubeY;
+    const size_t  x1 = std::min(vView.sizeX, x0 + m_MaxVoxelPerCubeX);
+    const size_t  y1 = std::min(vView.sizeY, y0 + m_MaxVoxelPerCubeY);
+    const int32_t z0 = vNode.tz * (int32_t)m_MaxVoxelPerCubeZ;
+    const int32_t z1 = z0 + (int32_t)m_MaxVoxelPerCubeZ;
+    for (size_t x = x0; x < x1; ++x) {
+        for (size_t y = y0; y < y1; ++y) {
+            const size_t  i      = x * vView.sizeY + y;
+            const int32_t bottom = std::max(z0, vView.bottoms ? vView.bottoms[i] : 0);
+            const int32_t height = std::min(z1, vView.heights[i]);
+            for (int32_t z = bottom; z < height; z++) {
+                out[0] = (uint8_t)(x - x0);
+                out[1] = (uint8_t)(y - y0);
+                out[2] = (uint8_t)(z - z0);
+                out[3] = vView.colors[i];
+                out += 4;
             }
         }
     }
+}
+
+const size_t VoxWriter::m_GetCubeId(const CubeX& vX, const CubeY& vY, const CubeZ& vZ) {
+    if (vX >= m_CubesCountX || vY >= m_CubesCountY || vZ >= m_CubesCountZ) {
+        m_GrowCubeIds(vX, vY, vZ);
+    }
+
+    auto& id = m_CubeIds[(vZ * m_CubesCountY + vY) * m_CubesCountX + vX];
+    if (id == 0) {
+        id = ++maxCubeId;
+    }
+
+    return id - 1;
+}
+
+void VoxWriter::m_GrowCubeIds(const CubeX& vX, const CubeY& vY, const CubeZ& vZ) {
+    // doubled, so a map added voxel by voxel regrows a few times only
+    const CubeX countX = m_CubesCountX > vX ? m_CubesCountX : std::max<size_t>(vX + 1, m_CubesCountX * 2);
+    const CubeY countY = m_CubesCountY > vY ? m_CubesCountY : std::max<size_t>(vY + 1, m_CubesCountY * 2);
+    const CubeZ countZ = m_CubesCountZ > vZ ? m_CubesCountZ : std::max<size_t>(vZ + 1, m_CubesCountZ * 2);
+
+    std::vector<CubeID> ids(countX * countY * countZ, 0);
+    for (CubeZ z = 0; z < m_CubesCountZ; z++) {
+        for (CubeY y = 0; y < m_CubesCountY; y++) {
+            std::copy_n(m_CubeIds.begin() + (z * m_CubesCountY + y) * m_CubesCountX, m_CubesCountX, ids.begin() + (z * countY + y) * countX);
+        }
+    }
+
+    m_CubeIds.swap(ids);
+    m_CubesCountX = countX;
+    m_CubesCountY = countY;
+    m_CubesCountZ = countZ;
+}
+
+Volume VoxWriter::m_GetVolume() const {
+    if (m_MinVoxelX > m_MaxVoxelX) {
+        return Volume(1e7, -1e7);
+    }
+    return Volume(ct::dvec3((double)m_MinVoxelX, (double)m_MinVoxelY, (double)m_MinVoxelZ), ct::dvec3((double)m_MaxVoxelX, (double)m_MaxVoxelY, (double)m_MaxVoxelZ));
+}
+
+void VoxWriter::m_SelectCube(VoxCube* vCube) {
+    if ((CubeID)vCube->id == m_LastCubeId && m_KeyFrame == m_LastKeyFrame) {
+        return;
+    }
+    m_LastCubeId    = vCube->id;
+    m_LastKeyFrame  = m_KeyFrame;
+    m_LastXYZI      = &vCube->xyzis[m_KeyFrame];
+    m_LastOccupancy = nullptr;
+    if (m_Deduplication) {
+        m_LastOccupancy = &vCube->occupancy[m_KeyFrame];
+        if (m_LastOccupancy->empty()) {
+            m_LastOccupancy->resize((m_MaxVoxelPerCubeX * m_MaxVoxelPerCubeY * m_MaxVoxelPerCubeZ + 63) / 64, 0);
+        }
+    }
+}
 
-    if (!exist) {
-        auto& xyzi = vCube->xyzis[m_KeyFrame];
-        xyzi.voxels.push_back(Wrap(vX, m_MaxVoxelPerCubeX));                      // x
-        xyzi.voxels.push_back(Wrap(vY, m_MaxVoxelPerCubeY));                      // y
-        xyzi.voxels.push_back(Wrap(vZ, m_MaxVoxelPerCubeZ));                      // z
+void VoxWriter::m_MergeColumnInCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZBegin, const VoxelZ& vZEnd, const uint8_t& vColorIndex, VoxCube* vCube) {
+    m_SelectCube(vCube);
+
+    if (m_LastOccupancy) {
+        // bits of the column are contiguous, set them all if none is set,
+        // else go voxel by voxel
+        const size_t first = (vX * m_MaxVoxelPerCubeY + vY) * m_MaxVoxelPerCubeZ;
+        const size_t begin = first + vZBegin;
+        const size_t end   = first + vZEnd;
+        auto&        words = *m_LastOccupancy;
+        auto         mask  = [&](size_t w) {
+            uint64_t res = ~uint64_t(0);
+            if (w == begin / 64) res &= ~uint64_t(0) << (begin % 64);
+            if (w == (end - 1) / 64) res &= ~uint64_t(0) >> (63 - (end - 1) % 64);
+            return res;
+        };
+        bool any = false;
+        for (size_t w = begin / 64; w <= (end - 1) / 64; w++) {
+            any = any || (words[w] & mask(w));
+        }
+        if (any) {
+            for (VoxelZ z = vZBegin; z < vZEnd; z++) {
+                m_MergeVoxelInCube(vX, vY, z, vColorIndex, vCube);
+            }
+            return;
+        }
+        for (size_t w = begin / 64; w <= (end - 1) / 64; w++) {
+            words[w] |= mask(w);
+        }
+    }
 
-        // correspond a la loc de la couleur du voxel en question
-        voxelId[m_KeyFrame][vX][vY][vZ] = (int)xyzi.voxels.size();
+    auto&        voxels = m_LastXYZI->voxels;
+    const size_t pos    = voxels.size();
+    voxels.resize(pos + 4 * (vZEnd - vZBegin));
+    uint8_t* out = voxels.data() + pos;
+    for (VoxelZ z = vZBegin; z < vZEnd; z++, out += 4) {
+        out[0] = (uint8_t)vX;
+        out[1] = (uint8_t)vY;
+        out[2] = (uint8_t)z;
+        out[3] = vColorIndex;
+    }
+}
 
-        xyzi.voxels.push_back(vColorIndex);  // color index
+void VoxWriter::m_MergeVoxelInCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ, const uint8_t& vColorIndex, VoxCube* vCube) {
+    m_SelectCube(vCube);
+
+    if (m_LastOccupancy) {
+        const size_t bit = (vX * m_MaxVoxelPerCubeY + vY) * m_MaxVoxelPerCubeZ + vZ;
+        uint64_t&    word = (*m_LastOccupancy)[bit / 64];
+        const uint64_t mask = uint64_t(1) << (bit % 64);
+        if (word & mask) {
+            return;
+        }
+        word |= mask;
     }
+
+    // x, y, z and the color index
+    const uint8_t voxel[4] = {(uint8_t)vX, (uint8_t)vY, (uint8_t)vZ, vColorIndex};
+    m_LastXYZI->voxels.insert(m_LastXYZI->voxels.end(), voxel, voxel + 4);
 }
 
-VoxCube* VoxWriter::m_GetCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ) {
+VoxCube* VoxWriter::m_GetCube(const CubeX& vX, const CubeY& vY, const CubeZ& vZ) {
     const auto& id = m_GetCubeId(vX, vY, vZ);
 
     if (id == cubes.size()) {
@@ -704,6 +1170,9 @@ VoxCube* VoxWriter::m_GetCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ&
         c.size.sizez = (int32_t)m_MaxVoxelPerCubeZ;
 
         cubes.push_back(c);
+
+        // the cubes may be moved
+        m_LastCubeId = SIZE_MAX;
     }
 
     if (id < cubes.size()) {
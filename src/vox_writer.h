@@ -35,6 +35,9 @@
 #include <cstdint>
 #include <sstream>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <thread>
 
 // extracted and adapted from https://github.com/aiekick/cTools (LICENSE MIT)
 // for make VoxWriter lib free
@@ -263,13 +266,28 @@ typedef std::function<void(const KeyFrame& vKeyFrame, const double& vValue)> Key
 
 inline uint32_t GetMVID(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { return (a) | (b << 8) | (c << 16) | (d << 24); }
 
+// the chunks are serialized in memory and the bytes go to the file
+// in blocks of flushSize, without a file all the bytes are kept
+struct ChunkBuffer {
+    std::vector<uint8_t> bytes;
+    FILE*                file      = nullptr;
+    size_t               flushSize = 1 << 20;
+
+    ChunkBuffer(FILE* vFile = nullptr);
+
+    void PutInt(const int32_t& vValue) { Put(&vValue, sizeof(int32_t)); }
+    void Put(const void* vData, const size_t& vSize);
+    // writes the kept bytes to the file
+    void Flush();
+};
+
 struct DICTstring {
     int32_t     bufferSize;
     std::string buffer;
 
     DICTstring();
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -280,16 +298,18 @@ struct DICTitem {
     DICTitem();
     DICTitem(std::string vKey, std::string vValue);
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
 struct DICT {
     int32_t               count;
     std::vector<DICTitem> keys;
+    // getSize, updated by Add
+    size_t                size;
 
     DICT();
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
     void   Add(std::string vKey, std::string vValue);
 };
@@ -305,7 +325,7 @@ struct nTRN {
 
     nTRN(int32_t countFrames);
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -317,7 +337,7 @@ struct nGRP {
 
     nGRP(int32_t vCount);
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -327,7 +347,7 @@ struct MODEL {
 
     MODEL();
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -339,7 +359,7 @@ struct nSHP {
 
     nSHP(int32_t vCount);
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -349,7 +369,7 @@ struct LAYR {
     int32_t reservedId;
 
     LAYR();
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -360,7 +380,7 @@ struct SIZE {
 
     SIZE();
 
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -369,7 +389,7 @@ struct XYZI {
     std::vector<uint8_t> voxels;
 
     XYZI();
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
@@ -377,10 +397,43 @@ struct RGBA {
     int32_t colors[256];
 
     RGBA();
-    void   write(FILE* fp);
+    void   write(ChunkBuffer& vBuffer);
     size_t getSize();
 };
 
+// Solid columns from z = 0 up to the height, the column x, y is
+// heights[x * sizeY + y] high and has the color colors[x * sizeY + y]
+// with bottoms, the column starts at bottoms[x * sizeY + y]
+struct HeightFieldView {
+    size_t         sizeX   = 0;
+    size_t         sizeY   = 0;
+    const int32_t* heights = nullptr;
+    const uint8_t* colors  = nullptr;
+    const int32_t* bottoms = nullptr;
+};
+
+// Where SaveHeightFieldToFile puts the cubes of a map: the bounds of its
+// voxels and its first cubes, see GetHeightFieldFrame. A view of the part
+// of the map from originX, originY gets the translations that part has
+// in the file of the whole map
+struct HeightFieldFrame {
+    size_t originX  = 0;
+    size_t originY  = 0;
+    CubeX  minCubeX = (CubeX)1e7;
+    CubeY  minCubeY = (CubeY)1e7;
+    CubeZ  minCubeZ = (CubeZ)1e7;
+    VoxelX minX     = SIZE_MAX;
+    VoxelY minY     = SIZE_MAX;
+    VoxelZ minZ     = SIZE_MAX;
+    VoxelX maxX     = 0;
+    VoxelY maxY     = 0;
+    VoxelZ maxZ     = 0;
+};
+
+// Bottoms of the visible part of the columns: the top voxel and the
+// voxels above the lowest of 4 neighbours, columns out of the map are 0
+std::vector<int32_t> GetShellBottoms(const HeightFieldView& vView);
+
 struct VoxCube {
     int id;
 
@@ -391,10 +444,12 @@ struct VoxCube {
 
     SIZE                     size;
     std::map<KeyFrame, XYZI> xyzis;
+    // one bit per voxel of the cube, set when the voxel is added
+    std::map<KeyFrame, std::vector<uint64_t>> occupancy;
 
     VoxCube();
 
-    void write(FILE* fp);
+    void write(ChunkBuffer& vBuffer);
 };
 
 
@@ -430,18 +485,45 @@ private:
 
     FILE*  m_File    = nullptr;
 
-    Volume maxVolume = Volume(1e7, -1e7);
-
     KeyFrame m_KeyFrame = 0;
 
     std::vector<ColorID> colors;
 
     std::vector<VoxCube> cubes;
 
-    std::map<CubeX, std::map<CubeY, std::map<CubeZ, CubeID>>>                         cubesId;
-    std::map<KeyFrame, std::map<VoxelX, std::map<VoxelY, std::map<VoxelZ, VoxelID>>>> voxelId;
-
-    int32_t lastError = 0;
+    // cube id + 1 by the cube position, 0 for no cube, x is the fastest
+    // the grid grows when a voxel lands outside
+    std::vector<CubeID> m_CubeIds;
+    CubeX               m_CubesCountX = 0;
+    CubeY               m_CubesCountY = 0;
+    CubeZ               m_CubesCountZ = 0;
+
+    // bounds of the added voxels, see m_GetVolume
+    VoxelX m_MinVoxelX = SIZE_MAX;
+    VoxelY m_MinVoxelY = SIZE_MAX;
+    VoxelZ m_MinVoxelZ = SIZE_MAX;
+    VoxelX m_MaxVoxelX = 0;
+    VoxelY m_MaxVoxelY = 0;
+    VoxelZ m_MaxVoxelZ = 0;
+
+    bool m_Deduplication = true;
+
+    // threads encoding the cubes and the scene graph while saving
+    size_t m_ThreadsCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    // bytes of the cubes one thread encodes before writing them
+    size_t m_WriteBlockSize = 4 << 20;
+#if _MSC_VER
+    std::mutex m_WriteMutex;
+#endif
+
+    // chunk and occupancy of the last cube, voxels come in runs
+    CubeID                 m_LastCubeId   = SIZE_MAX;
+    KeyFrame               m_LastKeyFrame = 0;
+    XYZI*                  m_LastXYZI     = nullptr;
+    std::vector<uint64_t>* m_LastOccupancy = nullptr;
+
+    // the first error, pool threads may fail together
+    std::atomic<int32_t> lastError{0};
 
     bool m_TimeLoggingEnabled = false; // for log elapsed time between key frames and total
 
@@ -467,19 +549,65 @@ public:
     void SetKeyFrame(uint32_t vKeyFrame);
     void AddColor(const uint8_t& r, const uint8_t& g, const uint8_t& b, const uint8_t& a, const uint8_t& index);
     void AddVoxel(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ, const uint8_t& vColorIndex);
+    // voxels vZBegin <= z < vZEnd, the same as AddVoxel for every z, but
+    // the cubes are found once per column and the voxels are appended in bulk
+    void AddColumn(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZBegin, const VoxelZ& vZEnd, const uint8_t& vColorIndex);
+    // AddColumn for every column, x then y, as the loop over the map does
+    void AddHeightField(const HeightFieldView& vView);
+    // on by default, a voxel added twice is written once
+    // switch off when the caller never adds a voxel twice
+    void SetDeduplication(const bool& vEnabled);
+    // 1 saves on the calling thread only
+    void SetThreadsCount(const size_t& vCount);
     void SaveToFile(const std::string& vFilePathName);
+    // the file AddHeightField and SaveToFile make on an empty writer, but
+    // the cubes are encoded from the view while writing: a first pass over
+    // the columns finds the cubes and their sizes, then one cube is held,
+    // with vFrame the cubes are placed in the frame instead of the view
+    void SaveHeightFieldToFile(const HeightFieldView& vView, const std::string& vFilePathName, const HeightFieldFrame* vFrame = nullptr);
+    // the frame of the whole view, the pass over the columns only
+    HeightFieldFrame GetHeightFieldFrame(const HeightFieldView& vView) const;
 
     const size_t GetVoxelsCount(const KeyFrame& vKeyFrame) const;
     const size_t GetVoxelsCount() const;
     void         PrintStats() const;
 
 private:
+    // position of a cube and its key frames, for the scene graph
+    struct CubeNode {
+        int32_t               tx = 0;
+        int32_t               ty = 0;
+        int32_t               tz = 0;
+        std::vector<KeyFrame> keyFrames;
+    };
+
     bool          m_OpenFileForWriting(const std::string& vFilePathName);
     void          m_CloseFile();
-    long          m_GetFilePos() const;
-    void          m_SetFilePos(const long& vPos);
-    const size_t  m_GetCubeId(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ);
-    VoxCube*      m_GetCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ);
+    int64_t       m_GetFilePos() const;
+    void          m_SetFilePos(const int64_t& vPos);
+    const size_t  m_GetCubeId(const CubeX& vX, const CubeY& vY, const CubeZ& vZ);
+    void          m_GrowCubeIds(const CubeX& vX, const CubeY& vY, const CubeZ& vZ);
+    VoxCube*      m_GetCube(const CubeX& vX, const CubeY& vY, const CubeZ& vZ);
+    // bounds of the voxels, Volume(1e7, -1e7) while there are none
+    Volume        m_GetVolume() const;
+    void          m_WriteHeader(ChunkBuffer& vBuffer, int64_t& vNumBytesMainChunkPos, int64_t& vHeaderSize);
+    // vOriginX, vOriginY are added to the voxels of the cubes
+    void          m_WriteSceneGraph(ChunkBuffer& vBuffer, const std::vector<CubeNode>& vNodes, const Volume& vVolume, const CubeX& vMinCubeX, const CubeY& vMinCubeY, const CubeZ& vMinCubeZ, const VoxelX& vOriginX = 0, const VoxelY& vOriginY = 0);
+    // the column in the bounds of the frame
+    void          m_AddColumnToFrame(HeightFieldFrame& vFrame, const VoxelX& vX, const VoxelY& vY, const int32_t& vBottom, const int32_t& vHeight) const;
+    // palette and the size of the main chunk
+    void          m_WriteFooter(ChunkBuffer& vBuffer, const int64_t& vNumBytesMainChunkPos, const int64_t& vHeaderSize);
+    // SIZE and XYZI chunks of the cube, vVoxelsCount from the first pass
+    void          m_EncodeHeightFieldCube(const HeightFieldView& vView, const CubeNode& vNode, const size_t& vVoxelsCount, uint8_t* vOut) const;
+    // writes at vPos without moving the stream, from any thread,
+    // the stream has to be flushed before
+    void          m_WriteAt(const uint8_t* vData, const size_t& vSize, const int64_t& vPos);
+    // vTask(task, thread) for the tasks [0, vTasksCount) on m_ThreadsCount threads
+    void          m_RunInParallel(const size_t& vTasksCount, const std::function<void(size_t, size_t)>& vTask) const;
+    // makes the chunk and the occupancy of the cube the last ones
+    void          m_SelectCube(VoxCube* vCube);
+    // vX, vY, vZ are in the cube
+    void          m_MergeColumnInCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZBegin, const VoxelZ& vZEnd, const uint8_t& vColorIndex, VoxCube* vCube);
     void          m_MergeVoxelInCube(const VoxelX& vX, const VoxelY& vY, const VoxelZ& vZ, const uint8_t& vColorIndex, VoxCube* vCube);
 };
 }  // namespace vox